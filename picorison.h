@@ -29,19 +29,22 @@
 #define picorison_h
 
 #include <algorithm>
-#include <cctype>
+#include <cfloat>
 #include <cmath>
 #include <cstdio>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <cstddef>
+#include <clocale>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <map>
-#include <set>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_set>
 #include <vector>
 #include <utility>
 
@@ -85,6 +88,29 @@ extern "C" {
   } while (0)
 #endif
 
+// SSE2 is used for scanning runs of plain characters unless PICORISON_NO_SIMD is defined
+#if !defined(PICORISON_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PICORISON_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// fd_sink needs PICORISON_USE_POSIX
+#ifdef PICORISON_USE_POSIX
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// parse_batch, parse_array_parallel and concurrent intern tables need PICORISON_USE_THREADS (and -pthread)
+#ifdef PICORISON_USE_THREADS
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#endif
+
 #ifdef _MSC_VER
 #define SNPRINTF _snprintf_s
 #pragma warning(push)
@@ -113,12 +139,204 @@ enum {
 
 enum { INDENT_WIDTH = 2 };
 
+// the container used for objects; any map template taking <key, mapped> works, e.g. picorison::flat_map or
+// std::unordered_map (include its header first)
+#ifndef PICORISON_OBJECT_MAP
+#define PICORISON_OBJECT_MAP std::map
+#endif
+
 struct null {};
 
+// a reference to characters owned by someone else, e.g. the input buffer of a borrowed_document
+class string_ref {
+protected:
+  const char *data_;
+  size_t size_;
+
+public:
+  string_ref() : data_(""), size_(0) {
+  }
+  string_ref(const char *data, size_t size) : data_(data), size_(size) {
+  }
+  string_ref(const char *s) : data_(s), size_(std::strlen(s)) {
+  }
+  string_ref(const std::string &s) : data_(s.data()), size_(s.size()) {
+  }
+  const char *data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  const char *begin() const {
+    return data_;
+  }
+  const char *end() const {
+    return data_ + size_;
+  }
+  char operator[](size_t idx) const {
+    return data_[idx];
+  }
+  std::string str() const {
+    return std::string(data_, size_);
+  }
+  int compare(const string_ref &x) const {
+    int r = std::memcmp(data_, x.data_, std::min(size_, x.size_));
+    return r != 0 ? r : size_ < x.size_ ? -1 : size_ > x.size_ ? 1 : 0;
+  }
+};
+
+inline bool operator==(const string_ref &x, const string_ref &y) {
+  return x.size() == y.size() && std::memcmp(x.data(), y.data(), x.size()) == 0;
+}
+
+inline bool operator!=(const string_ref &x, const string_ref &y) {
+  return !(x == y);
+}
+
+inline bool operator<(const string_ref &x, const string_ref &y) {
+  return x.compare(y) < 0;
+}
+
+// a map kept as a vector sorted by key; lookups are binary searches over contiguous memory and appending keys in
+// ascending order (as RISON objects are written) is amortized O(1)
+template <typename Key, typename T> class flat_map {
+public:
+  typedef Key key_type;
+  typedef T mapped_type;
+  typedef std::pair<Key, T> value_type;
+  typedef typename std::vector<value_type>::iterator iterator;
+  typedef typename std::vector<value_type>::const_iterator const_iterator;
+  typedef size_t size_type;
+
+protected:
+  std::vector<value_type> items_;
+
+public:
+  flat_map() : items_() {
+  }
+  iterator begin() {
+    return items_.begin();
+  }
+  iterator end() {
+    return items_.end();
+  }
+  const_iterator begin() const {
+    return items_.begin();
+  }
+  const_iterator end() const {
+    return items_.end();
+  }
+  size_type size() const {
+    return items_.size();
+  }
+  bool empty() const {
+    return items_.empty();
+  }
+  void clear() {
+    items_.clear();
+  }
+  void reserve(size_type n) {
+    items_.reserve(n);
+  }
+  void swap(flat_map &x) {
+    items_.swap(x.items_);
+  }
+  iterator lower_bound(const Key &key) {
+    return std::lower_bound(items_.begin(), items_.end(), key, key_less());
+  }
+  const_iterator lower_bound(const Key &key) const {
+    return std::lower_bound(items_.begin(), items_.end(), key, key_less());
+  }
+  iterator find(const Key &key) {
+    iterator i = lower_bound(key);
+    return i != items_.end() && !(key < i->first) ? i : items_.end();
+  }
+  const_iterator find(const Key &key) const {
+    const_iterator i = lower_bound(key);
+    return i != items_.end() && !(key < i->first) ? i : items_.end();
+  }
+  size_type count(const Key &key) const {
+    return find(key) != end() ? 1 : 0;
+  }
+  std::pair<iterator, bool> insert(const value_type &item) {
+    return emplace_key(item.first, item.second);
+  }
+  std::pair<iterator, bool> insert(value_type &&item) {
+    return emplace_key(std::move(item.first), std::move(item.second));
+  }
+  T &operator[](const Key &key) {
+    return emplace_key(key, T()).first->second;
+  }
+  T &operator[](Key &&key) {
+    return emplace_key(std::move(key), T()).first->second;
+  }
+  T &at(const Key &key) {
+    iterator i = find(key);
+    if (i == end()) {
+      throw std::out_of_range("flat_map::at");
+    }
+    return i->second;
+  }
+  const T &at(const Key &key) const {
+    const_iterator i = find(key);
+    if (i == end()) {
+      throw std::out_of_range("flat_map::at");
+    }
+    return i->second;
+  }
+  iterator erase(const_iterator pos) {
+    return items_.erase(begin() + (pos - items_.begin()));
+  }
+  size_type erase(const Key &key) {
+    iterator i = find(key);
+    if (i == end()) {
+      return 0;
+    }
+    items_.erase(i);
+    return 1;
+  }
+  bool operator==(const flat_map &x) const {
+    return items_ == x.items_;
+  }
+  bool operator!=(const flat_map &x) const {
+    return items_ != x.items_;
+  }
+
+protected:
+  struct key_less {
+    bool operator()(const value_type &item, const Key &key) const {
+      return item.first < key;
+    }
+  };
+  template <typename K, typename V> std::pair<iterator, bool> emplace_key(K &&key, V &&mapped) {
+    iterator i;
+    if (items_.empty() || items_.back().first < key) {
+      i = items_.end();
+    } else {
+      i = lower_bound(key);
+      if (!(key < i->first)) {
+        return std::make_pair(i, false);
+      }
+    }
+    return std::make_pair(items_.insert(i, value_type(std::forward<K>(key), std::forward<V>(mapped))), true);
+  }
+};
+
+// whether iterating an object container yields keys in ascending order; others are sorted when serialized
+template <typename Object> struct object_traits { static const bool sorted = false; };
+template <typename Key, typename T, typename Compare, typename Alloc> struct object_traits<std::map<Key, T, Compare, Alloc> > {
+  static const bool sorted = true;
+};
+template <typename Key, typename T> struct object_traits<flat_map<Key, T> > { static const bool sorted = true; };
+
 class value {
 public:
   typedef std::vector<value> array;
-  typedef std::map<std::string, value> object;
+  typedef PICORISON_OBJECT_MAP<std::string, value> object;
   union _storage {
     bool boolean_;
     double number_;
@@ -172,10 +390,12 @@ public:
   std::string to_str() const;
   template <typename Iter> void serialize(Iter os) const;
   std::string serialize() const;
+  size_t serialized_size() const;
+  size_t serialize_to(char *buf, size_t cap) const;
 
 private:
   template <typename T> value(const T *); // intentionally defined to block implicit conversion of pointer to bool
-  template <typename Iter> void _serialize(Iter os) const;
+  template <typename Iter> void _serialize(Iter &os) const;
   std::string _serialize() const;
   void clear();
 };
@@ -447,6 +667,223 @@ inline bool value::contains(const std::string &key) const {
   return i != u_.object_->end();
 }
 
+// Number formatting.  Doubles are written with the Grisu2 algorithm (Loitsch, "Printing Floating-Point Numbers Quickly
+// and Accurately with Integers"), whose output always reads back as the same double and is the shortest such decimal
+// in almost all cases.
+struct _diy_fp {
+  uint64_t f;
+  int e;
+};
+
+inline _diy_fp _diy_fp_mul(const _diy_fp &x, const _diy_fp &y) {
+  // the upper half of the 128-bit product, rounded
+  const uint64_t x_lo = x.f & 0xffffffffu, x_hi = x.f >> 32, y_lo = y.f & 0xffffffffu, y_hi = y.f >> 32;
+  const uint64_t p0 = x_lo * y_lo, p1 = x_lo * y_hi, p2 = x_hi * y_lo, p3 = x_hi * y_hi;
+  uint64_t mid = (p0 >> 32) + (p1 & 0xffffffffu) + (p2 & 0xffffffffu) + (uint64_t(1) << 31);
+  _diy_fp r = {p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32), x.e + y.e + 64};
+  return r;
+}
+
+inline _diy_fp _diy_fp_normalize(_diy_fp x) {
+  while ((x.f >> 63) == 0) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+struct _cached_power {
+  uint64_t f;
+  int e;
+  int k; // the power of ten
+};
+
+// 10^k for k in [-300, 324] in steps of 8, normalized to 64-bit significands
+template <typename T> struct cached_powers_t {
+  static constexpr _cached_power table[79] = {
+      {0xAB70FE17C79AC6CAull, -1060, -300}, {0xFF77B1FCBEBCDC4Full, -1034, -292}, {0xBE5691EF416BD60Cull, -1007, -284},
+      {0x8DD01FAD907FFC3Cull, -980, -276}, {0xD3515C2831559A83ull, -954, -268}, {0x9D71AC8FADA6C9B5ull, -927, -260},
+      {0xEA9C227723EE8BCBull, -901, -252}, {0xAECC49914078536Dull, -874, -244}, {0x823C12795DB6CE57ull, -847, -236},
+      {0xC21094364DFB5637ull, -821, -228}, {0x9096EA6F3848984Full, -794, -220}, {0xD77485CB25823AC7ull, -768, -212},
+      {0xA086CFCD97BF97F4ull, -741, -204}, {0xEF340A98172AACE5ull, -715, -196}, {0xB23867FB2A35B28Eull, -688, -188},
+      {0x84C8D4DFD2C63F3Bull, -661, -180}, {0xC5DD44271AD3CDBAull, -635, -172}, {0x936B9FCEBB25C996ull, -608, -164},
+      {0xDBAC6C247D62A584ull, -582, -156}, {0xA3AB66580D5FDAF6ull, -555, -148}, {0xF3E2F893DEC3F126ull, -529, -140},
+      {0xB5B5ADA8AAFF80B8ull, -502, -132}, {0x87625F056C7C4A8Bull, -475, -124}, {0xC9BCFF6034C13053ull, -449, -116},
+      {0x964E858C91BA2655ull, -422, -108}, {0xDFF9772470297EBDull, -396, -100}, {0xA6DFBD9FB8E5B88Full, -369, -92},
+      {0xF8A95FCF88747D94ull, -343, -84}, {0xB94470938FA89BCFull, -316, -76}, {0x8A08F0F8BF0F156Bull, -289, -68},
+      {0xCDB02555653131B6ull, -263, -60}, {0x993FE2C6D07B7FACull, -236, -52}, {0xE45C10C42A2B3B06ull, -210, -44},
+      {0xAA242499697392D3ull, -183, -36}, {0xFD87B5F28300CA0Eull, -157, -28}, {0xBCE5086492111AEBull, -130, -20},
+      {0x8CBCCC096F5088CCull, -103, -12}, {0xD1B71758E219652Cull, -77, -4}, {0x9C40000000000000ull, -50, 4},
+      {0xE8D4A51000000000ull, -24, 12}, {0xAD78EBC5AC620000ull, 3, 20}, {0x813F3978F8940984ull, 30, 28},
+      {0xC097CE7BC90715B3ull, 56, 36}, {0x8F7E32CE7BEA5C70ull, 83, 44}, {0xD5D238A4ABE98068ull, 109, 52},
+      {0x9F4F2726179A2245ull, 136, 60}, {0xED63A231D4C4FB27ull, 162, 68}, {0xB0DE65388CC8ADA8ull, 189, 76},
+      {0x83C7088E1AAB65DBull, 216, 84}, {0xC45D1DF942711D9Aull, 242, 92}, {0x924D692CA61BE758ull, 269, 100},
+      {0xDA01EE641A708DEAull, 295, 108}, {0xA26DA3999AEF774Aull, 322, 116}, {0xF209787BB47D6B85ull, 348, 124},
+      {0xB454E4A179DD1877ull, 375, 132}, {0x865B86925B9BC5C2ull, 402, 140}, {0xC83553C5C8965D3Dull, 428, 148},
+      {0x952AB45CFA97A0B3ull, 455, 156}, {0xDE469FBD99A05FE3ull, 481, 164}, {0xA59BC234DB398C25ull, 508, 172},
+      {0xF6C69A72A3989F5Cull, 534, 180}, {0xB7DCBF5354E9BECEull, 561, 188}, {0x88FCF317F22241E2ull, 588, 196},
+      {0xCC20CE9BD35C78A5ull, 614, 204}, {0x98165AF37B2153DFull, 641, 212}, {0xE2A0B5DC971F303Aull, 667, 220},
+      {0xA8D9D1535CE3B396ull, 694, 228}, {0xFB9B7CD9A4A7443Cull, 720, 236}, {0xBB764C4CA7A44410ull, 747, 244},
+      {0x8BAB8EEFB6409C1Aull, 774, 252}, {0xD01FEF10A657842Cull, 800, 260}, {0x9B10A4E5E9913129ull, 827, 268},
+      {0xE7109BFBA19C0C9Dull, 853, 276}, {0xAC2820D9623BF429ull, 880, 284}, {0x80444B5E7AA7CF85ull, 907, 292},
+      {0xBF21E44003ACDD2Dull, 933, 300}, {0x8E679C2F5E44FF8Full, 960, 308}, {0xD433179D9C8CB841ull, 986, 316},
+      {0x9E19DB92B4E31BA9ull, 1013, 324},
+  };
+};
+template <typename T> constexpr _cached_power cached_powers_t<T>::table[79];
+
+// returns a power of ten c such that the binary exponent of w * c is in [-60, -32] for a normalized w with exponent e
+inline const _cached_power &_cached_power_for(int e) {
+  const int f = -60 - e - 1;
+  const int k = (f * 78913) / (1 << 18) + (f > 0); // ceil(f * log10(2))
+  return cached_powers_t<bool>::table[(300 + k + 7) / 8];
+}
+
+// moves the last digit towards w while the result stays within the boundaries
+inline void _grisu2_round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+  while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+    buf[len - 1]--;
+    rest += ten_k;
+  }
+}
+
+// writes the shortest digits of a value in (m_minus, m_plus) closest to w, all scaled to an exponent in [-60, -32]
+inline int _grisu2_digits(char *buf, int &exp10, const _diy_fp &m_minus, const _diy_fp &w, const _diy_fp &m_plus) {
+  uint64_t delta = m_plus.f - m_minus.f, dist = m_plus.f - w.f;
+  const int shift = -m_plus.e;
+  const uint64_t one = uint64_t(1) << shift;
+  uint32_t p1 = static_cast<uint32_t>(m_plus.f >> shift);
+  uint64_t p2 = m_plus.f & (one - 1);
+  int len = 0;
+
+  // the integral part, p1 < 2^32
+  uint32_t pow10 = 1000000000;
+  int n = 10;
+  for (; n > 1 && p1 < pow10; --n) {
+    pow10 /= 10;
+  }
+  while (n > 0) {
+    buf[len++] = static_cast<char>('0' + p1 / pow10);
+    p1 %= pow10;
+    --n;
+    uint64_t rest = (uint64_t(p1) << shift) + p2;
+    if (rest <= delta) {
+      exp10 += n;
+      _grisu2_round(buf, len, dist, delta, rest, uint64_t(pow10) << shift);
+      return len;
+    }
+    pow10 /= 10;
+  }
+
+  // the fractional part
+  int m = 0;
+  do {
+    p2 *= 10;
+    buf[len++] = static_cast<char>('0' + (p2 >> shift));
+    p2 &= one - 1;
+    ++m;
+    delta *= 10;
+    dist *= 10;
+  } while (p2 > delta);
+  exp10 -= m;
+  _grisu2_round(buf, len, dist, delta, p2, one);
+  return len;
+}
+
+// writes the digits of a positive finite v to buf (at least 17 chars) and returns their number; v = digits * 10^exp10
+inline int _grisu2(char *buf, int &exp10, double v) {
+  uint64_t bits;
+  std::memcpy(&bits, &v, sizeof(bits));
+  const uint64_t hidden = uint64_t(1) << 52;
+  const uint64_t frac = bits & (hidden - 1);
+  const int biased = static_cast<int>(bits >> 52);
+  _diy_fp x = biased == 0 ? _diy_fp{frac, 1 - 1075} : _diy_fp{frac + hidden, biased - 1075};
+
+  // the boundaries halfway to the neighbouring doubles; the lower one is closer at powers of two
+  _diy_fp m_plus = _diy_fp_normalize(_diy_fp{2 * x.f + 1, x.e - 1});
+  _diy_fp m_minus = frac == 0 && biased > 1 ? _diy_fp{4 * x.f - 1, x.e - 2} : _diy_fp{2 * x.f - 1, x.e - 1};
+  m_minus.f <<= m_minus.e - m_plus.e;
+  m_minus.e = m_plus.e;
+  _diy_fp w = _diy_fp_normalize(x);
+
+  const _cached_power &c = _cached_power_for(m_plus.e);
+  const _diy_fp c_minus_k = {c.f, c.e};
+  _diy_fp w_minus = _diy_fp_mul(m_minus, c_minus_k), w_plus = _diy_fp_mul(m_plus, c_minus_k);
+  // shrink the interval by one ulp on each side for the error of the multiplications
+  ++w_minus.f;
+  --w_plus.f;
+  exp10 = -c.k;
+  return _grisu2_digits(buf, exp10, w_minus, _diy_fp_mul(w, c_minus_k), w_plus);
+}
+
+// writes i to buf (at least 20 chars) and returns the end
+inline char *_format_uint64(char *buf, uint64_t i) {
+  char tmp[20], *p = tmp + sizeof(tmp);
+  do {
+    *--p = static_cast<char>('0' + i % 10);
+    i /= 10;
+  } while (i != 0);
+  size_t len = tmp + sizeof(tmp) - p;
+  std::memcpy(buf, p, len);
+  return buf + len;
+}
+
+// writes i to buf (at least 20 chars) and returns the end
+inline char *_format_int64(char *buf, int64_t i) {
+  if (i < 0) {
+    *buf++ = '-';
+    return _format_uint64(buf, 0 - static_cast<uint64_t>(i));
+  }
+  return _format_uint64(buf, static_cast<uint64_t>(i));
+}
+
+// Writes a finite v to buf (at least 25 chars) and returns the end.  The layout is that of JavaScript's
+// Number.prototype.toString, e.g. 100, 0.001, 1.5e21 and 1e-7, but the exponent is written without '+' and
+// negative zero as "-0" so that it reads back as such.
+inline char *_format_double(char *buf, double v) {
+  if (std::signbit(v)) {
+    *buf++ = '-';
+    v = -v;
+  }
+  if (v == 0) {
+    *buf++ = '0';
+    return buf;
+  }
+  char digits[18];
+  int exp10;
+  const int len = _grisu2(digits, exp10, v);
+  const int point = len + exp10; // the position of the decimal point relative to the first digit
+  if (len <= point && point <= 21) {
+    std::memcpy(buf, digits, len);
+    std::memset(buf + len, '0', point - len);
+    return buf + point;
+  } else if (0 < point && point <= 21) {
+    std::memcpy(buf, digits, point);
+    buf[point] = '.';
+    std::memcpy(buf + point + 1, digits + point, len - point);
+    return buf + len + 1;
+  } else if (-6 < point && point <= 0) {
+    buf[0] = '0';
+    buf[1] = '.';
+    std::memset(buf + 2, '0', -point);
+    std::memcpy(buf + 2 - point, digits, len);
+    return buf + 2 - point + len;
+  }
+  *buf++ = digits[0];
+  if (len > 1) {
+    *buf++ = '.';
+    std::memcpy(buf, digits + 1, len - 1);
+    buf += len - 1;
+  }
+  *buf++ = 'e';
+  int e = point - 1;
+  if (e < 0) {
+    *buf++ = '-';
+    e = -e;
+  }
+  return _format_uint64(buf, static_cast<uint64_t>(e));
+}
+
 inline std::string value::to_str() const {
   switch (type_) {
   case null_type:
@@ -455,27 +892,13 @@ inline std::string value::to_str() const {
     return u_.boolean_ ? "!t" : "!f";
 #ifdef PICORISON_USE_INT64
   case int64_type: {
-    char buf[sizeof("-9223372036854775808")];
-    SNPRINTF(buf, sizeof(buf), "%" PRId64, u_.int64_);
-    return buf;
+    char buf[32];
+    return std::string(buf, _format_int64(buf, u_.int64_));
   }
 #endif
   case number_type: {
-    char buf[64];
-    double integral;
-    SNPRINTF(
-      buf,
-      sizeof(buf),
-      std::fabs(u_.number_) < (1ULL << 53) && std::modf(u_.number_, &integral) == 0
-        ? "%.f"
-        : "%.17g",
-      u_.number_);
-    std::string s(buf);
-    std::string::size_type pos = s.rfind("e+");
-    if (pos != std::string::npos) {
-      s.replace(pos, std::strlen("e+"), "e");
-    }
-    return s;
+    char buf[32];
+    return std::string(buf, _format_double(buf, u_.number_));
   }
   case string_type:
     return *u_.string_;
@@ -492,58 +915,245 @@ inline std::string value::to_str() const {
   return std::string();
 }
 
+// character classes shared by the parser and the serializer
+enum {
+  id_char_class = 1,         // may appear in an unquoted id
+  id_start_reject_class = 2, // may not start an unquoted id, so a string starting with it must be quoted
+  quote_char_class = 4,      // a string containing it must be quoted
+  escape_char_class = 8,     // escaped with '!' inside quoted strings
+  control_char_class = 16
+};
+
+template <typename T> struct char_class_t {
+  static constexpr unsigned char table[256] = {
+      16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+      16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+       4, 12,  4,  4,  4,  4,  4, 12,  4,  4,  4,  4,  4,  3,  1,  1,
+       3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,  4,  4,  4,
+       4,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+       1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  4,  4,  4,  4,  1,
+       4,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+       1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  4,  4,  4,  1, 16,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+       0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  };
+};
+template <typename T> constexpr unsigned char char_class_t<T>::table[256];
+
+inline int char_class(int ch) {
+  return char_class_t<bool>::table[static_cast<unsigned char>(ch)];
+}
+
+#ifdef PICORISON_SSE2
+inline int _first_bit(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return static_cast<int>(idx);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// returns the first quote, escape or control character in [p, end), or end
+template <typename Ch> inline Ch *_find_string_special(Ch *p, Ch *end) {
+#ifdef PICORISON_SSE2
+  const __m128i quote = _mm_set1_epi8('\''), bang = _mm_set1_epi8('!'), ctrl = _mm_set1_epi8(0x1f);
+  for (; end - p >= 16; p += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, bang)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+    if (mask != 0) {
+      return p + _first_bit(mask);
+    }
+  }
+#endif
+  for (; p != end; ++p) {
+    unsigned char c = static_cast<unsigned char>(*p);
+    if (c == '\'' || c == '!' || c < ' ') {
+      break;
+    }
+  }
+  return p;
+}
+
+#ifdef PICORISON_SSE2
+// the bits of the bytes of x that may appear in an unquoted id
+inline unsigned _id_char_mask(__m128i x) {
+  const __m128i digit_lo = _mm_set1_epi8('0'), digit_span = _mm_set1_epi8(9);
+  const __m128i lower = _mm_set1_epi8(0x20), alpha_lo = _mm_set1_epi8('a'), alpha_span = _mm_set1_epi8(25);
+  const __m128i punct_lo = _mm_set1_epi8('-'), punct_span = _mm_set1_epi8(2); // '-', '.' and '/'
+  const __m128i underscore = _mm_set1_epi8('_'), tilde = _mm_set1_epi8('~');
+  __m128i d = _mm_sub_epi8(x, digit_lo), a = _mm_sub_epi8(_mm_or_si128(x, lower), alpha_lo), s = _mm_sub_epi8(x, punct_lo);
+  __m128i id = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(d, digit_span), d),
+                                         _mm_cmpeq_epi8(_mm_min_epu8(a, alpha_span), a)),
+                            _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(s, punct_span), s),
+                                         _mm_or_si128(_mm_cmpeq_epi8(x, underscore), _mm_cmpeq_epi8(x, tilde))));
+  return static_cast<unsigned>(_mm_movemask_epi8(id));
+}
+#endif
+
+// returns the first character in [p, end) that may not appear in an unquoted id, or end
+template <typename Ch> inline Ch *_find_id_end(Ch *p, Ch *end) {
+#ifdef PICORISON_SSE2
+  for (; end - p >= 16; p += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    unsigned mask = ~_id_char_mask(x) & 0xffff;
+    if (mask != 0) {
+      return p + _first_bit(mask);
+    }
+  }
+#endif
+  for (; p != end && (char_class(*p) & id_char_class); ++p)
+    ;
+  return p;
+}
+
+// returns the first character in [p, end) that makes a string need quotes, or end; every ASCII character is either
+// allowed in ids or has quote_char_class or control_char_class, and other bytes never need quotes
+template <typename Ch> inline Ch *_find_quote_char(Ch *p, Ch *end) {
+#ifdef PICORISON_SSE2
+  for (; end - p >= 16; p += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    unsigned mask = ~(_id_char_mask(x) | static_cast<unsigned>(_mm_movemask_epi8(x))) & 0xffff;
+    if (mask != 0) {
+      return p + _first_bit(mask);
+    }
+  }
+#endif
+  for (; p != end && !(char_class(*p) & (quote_char_class | control_char_class)); ++p)
+    ;
+  return p;
+}
+
 template <typename Iter> void copy(const std::string &s, Iter oi) {
   std::copy(s.begin(), s.end(), oi);
 }
 
-template <typename Iter> struct serialize_str_char {
-  Iter oi;
-  void operator()(char c) {
-    switch (c) {
-#define MAP(val, sym)                                                                                                              \
-  case val:                                                                                                                        \
-    copy(sym, oi);                                                                                                                 \
-    break
-      MAP('!', "!!");
-      MAP('\'', "!'");
-#undef MAP
-    default:
-      if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
-        // Control character
-        // TODO(haruki): raise serialize error
-      } else {
-        *oi++ = c;
-      }
+template <typename Iter> inline void _copy_run(Iter &oi, const char *first, const char *last) {
+  oi = std::copy(first, last, oi);
+}
+
+inline void _copy_run(char *&oi, const char *first, const char *last) {
+  std::memcpy(oi, first, last - first);
+  oi += last - first;
+}
+
+// Writes s as an id if it can be parsed back as one, or else quoted.  The string is scanned once: up to the first
+// character that needs quotes, runs are copied as is, and the rest is copied between the characters to escape.
+template <typename Iter> void _serialize_str(const string_ref &s, Iter &oi) {
+  const char *p = s.data(), *end = p + s.size();
+  const char *q = _find_quote_char(p, end);
+  if (q == end && p != end && !(char_class(*p) & id_start_reject_class)) {
+    _copy_run(oi, p, end);
+    return;
+  }
+  *oi++ = '\'';
+  while (1) {
+    _copy_run(oi, p, q);
+    if (q == end) {
       break;
     }
+    if (*q == '!' || *q == '\'') {
+      *oi++ = '!';
+      *oi++ = *q;
+    } else if (static_cast<unsigned char>(*q) >= ' ') {
+      *oi++ = *q;
+    } else {
+      // TODO(haruki): raise serialize error for control characters, which are dropped
+    }
+    p = q + 1;
+    q = _find_string_special(p, end);
   }
-};
+  *oi++ = '\'';
+}
 
 template <typename Iter> void serialize_str(const std::string &s, Iter oi) {
-  const std::string need_to_quoted_start = "-0123456789";
-  const std::string need_to_quoted_graph = "!\"#$%&'()*+,:;<=>?@[\\]^`{|} ";
-  bool needs_quote = (need_to_quoted_start.find(s[0]) != std::string::npos)
-      || std::any_of(s.begin(), s.end(), [&need_to_quoted_graph](char c) {
-    return need_to_quoted_graph.find(c) != std::string::npos;
-  });
-  if (needs_quote) { *oi++ = '\''; }
-  serialize_str_char<Iter> process_char = {oi};
-  std::for_each(s.begin(), s.end(), process_char);
-  if (needs_quote) { *oi++ = '\''; }
+  _serialize_str(s, oi);
+}
+
+// the length of s as written by serialize_str
+inline size_t _serialized_str_size(const string_ref &s) {
+  const char *p = s.data(), *end = p + s.size();
+  const char *q = _find_quote_char(p, end);
+  if (q == end && p != end && !(char_class(*p) & id_start_reject_class)) {
+    return s.size();
+  }
+  size_t n = s.size() + 2;
+  for (; q != end; q = _find_string_special(q + 1, end)) {
+    if (*q == '!' || *q == '\'') {
+      ++n;
+    } else if (static_cast<unsigned char>(*q) < ' ') {
+      --n;
+    }
+  }
+  return n;
 }
 
 template <typename Iter> void value::serialize(Iter oi) const {
-  return _serialize(oi);
+  _serialize(oi);
 }
 
 inline std::string value::serialize() const {
   return _serialize();
 }
 
-template <typename Iter> void value::_serialize(Iter oi) const {
+// computes the length of serialize() without writing it; strings are scanned and numbers formatted on the stack
+inline size_t value::serialized_size() const {
+  switch (type_) {
+  case string_type:
+    return _serialized_str_size(*u_.string_);
+  case array_type: {
+    size_t n = u_.array_->empty() ? 3 : 2 + u_.array_->size();
+    for (array::const_iterator i = u_.array_->begin(); i != u_.array_->end(); ++i) {
+      n += i->serialized_size();
+    }
+    return n;
+  }
+  case object_type: {
+    size_t n = u_.object_->empty() ? 2 : 1 + 2 * u_.object_->size();
+    for (object::const_iterator i = u_.object_->begin(); i != u_.object_->end(); ++i) {
+      n += _serialized_str_size(i->first) + i->second.serialized_size();
+    }
+    return n;
+  }
+#ifdef PICORISON_USE_INT64
+  case int64_type: {
+    char buf[32];
+    return _format_int64(buf, u_.int64_) - buf;
+  }
+#endif
+  case number_type: {
+    char buf[32];
+    return _format_double(buf, u_.number_) - buf;
+  }
+  default:
+    return 2; // !n, !t or !f
+  }
+}
+
+// Writes serialize() to buf, without a terminating NUL, if it fits in cap chars.  Returns its length, which is
+// larger than cap if nothing was written.
+inline size_t value::serialize_to(char *buf, size_t cap) const {
+  size_t n = serialized_size();
+  if (n <= cap) {
+    _serialize(buf);
+  }
+  return n;
+}
+
+template <typename Iter> void value::_serialize(Iter &oi) const {
   switch (type_) {
   case string_type:
-    serialize_str(*u_.string_, oi);
+    _serialize_str(*u_.string_, oi);
     break;
   case array_type: {
     *oi++ = '!';
@@ -559,96 +1169,561 @@ template <typename Iter> void value::_serialize(Iter oi) const {
   }
   case object_type: {
     *oi++ = '(';
-    for (object::const_iterator i = u_.object_->begin(); i != u_.object_->end(); ++i) {
-      if (i != u_.object_->begin()) {
-        *oi++ = ',';
+    if (object_traits<object>::sorted) {
+      for (object::const_iterator i = u_.object_->begin(); i != u_.object_->end(); ++i) {
+        if (i != u_.object_->begin()) {
+          *oi++ = ',';
+        }
+        _serialize_str(i->first, oi);
+        *oi++ = ':';
+        i->second._serialize(oi);
+      }
+    } else {
+      std::vector<const object::value_type *> members;
+      members.reserve(u_.object_->size());
+      for (object::const_iterator i = u_.object_->begin(); i != u_.object_->end(); ++i) {
+        members.push_back(&*i);
+      }
+      std::sort(members.begin(), members.end(),
+                [](const object::value_type *x, const object::value_type *y) { return x->first < y->first; });
+      for (size_t i = 0; i != members.size(); ++i) {
+        if (i != 0) {
+          *oi++ = ',';
+        }
+        _serialize_str(members[i]->first, oi);
+        *oi++ = ':';
+        members[i]->second._serialize(oi);
       }
-      serialize_str(i->first, oi);
-      *oi++ = ':';
-      i->second._serialize(oi);
     }
     *oi++ = ')';
     break;
   }
+#ifdef PICORISON_USE_INT64
+  case int64_type: {
+    char buf[32];
+    _copy_run(oi, buf, _format_int64(buf, u_.int64_));
+    break;
+  }
+#endif
+  case number_type: {
+    char buf[32];
+    _copy_run(oi, buf, _format_double(buf, u_.number_));
+    break;
+  }
+  case boolean_type:
+    *oi++ = '!';
+    *oi++ = u_.boolean_ ? 't' : 'f';
+    break;
   default:
-    copy(to_str(), oi);
+    *oi++ = '!';
+    *oi++ = 'n';
     break;
   }
 }
 
 inline std::string value::_serialize() const {
-  std::string s;
-  _serialize(std::back_inserter(s));
+  std::string s(serialized_size(), '\0');
+  char *p = &s[0];
+  _serialize(p);
   return s;
 }
 
-template <typename Iter> class input {
-protected:
-  Iter cur_, end_;
-  bool consumed_;
-  int line_;
+// Sinks receive serialized output as runs of characters.  A sink provides put(char) and write(const char *, size_t);
+// picorison::serialize(v, sink) passes whole runs (keys, string bodies and number text) to write.
+template <typename Sink> class sink_iterator {
+  Sink *sink_;
 
 public:
-  input(const Iter &first, const Iter &last) : cur_(first), end_(last), consumed_(false), line_(1) {
+  typedef std::output_iterator_tag iterator_category;
+  typedef void value_type;
+  typedef void difference_type;
+  typedef void pointer;
+  typedef void reference;
+  explicit sink_iterator(Sink *sink) : sink_(sink) {
   }
-  int getc() {
-    if (consumed_) {
-      if (*cur_ == '\n') {
-        ++line_;
-      }
-      ++cur_;
-    }
-    if (cur_ == end_) {
-      consumed_ = false;
-      return -1;
-    }
-    consumed_ = true;
-    return *cur_ & 0xff;
+  sink_iterator &operator=(char c) {
+    sink_->put(c);
+    return *this;
   }
-  void ungetc() {
-    consumed_ = false;
+  sink_iterator &operator*() {
+    return *this;
   }
-  Iter cur() const {
-    if (consumed_) {
-      input<Iter> *self = const_cast<input<Iter> *>(this);
-      self->consumed_ = false;
-      ++self->cur_;
-    }
-    return cur_;
+  sink_iterator &operator++() {
+    return *this;
   }
-  int line() const {
-    return line_;
+  sink_iterator &operator++(int) {
+    return *this;
   }
-  bool expect(const int expected) {
-    if (getc() != expected) {
-      ungetc();
-      return false;
-    }
-    return true;
+  Sink *sink() const {
+    return sink_;
   }
-  bool match(const std::string &pattern) {
-    for (std::string::const_iterator pi(pattern.begin()); pi != pattern.end(); ++pi) {
-      if (getc() != *pi) {
-        ungetc();
-        return false;
-      }
+};
+
+template <typename Sink> inline void _copy_run(sink_iterator<Sink> &oi, const char *first, const char *last) {
+  oi.sink()->write(first, static_cast<size_t>(last - first));
+}
+
+template <typename Sink> inline void serialize(const value &v, Sink &sink) {
+  v.serialize(sink_iterator<Sink>(&sink));
+}
+
+class string_sink {
+  std::string *s_;
+
+public:
+  explicit string_sink(std::string *s) : s_(s) {
+  }
+  void put(char c) {
+    s_->push_back(c);
+  }
+  void write(const char *p, size_t n) {
+    s_->append(p, n);
+  }
+};
+
+// writes to a std::streambuf, which does its own buffering
+class streambuf_sink {
+  std::streambuf *sb_;
+  bool good_;
+
+public:
+  explicit streambuf_sink(std::streambuf *sb) : sb_(sb), good_(true) {
+  }
+  void put(char c) {
+    good_ = good_ && sb_->sputc(c) != std::streambuf::traits_type::eof();
+  }
+  void write(const char *p, size_t n) {
+    good_ = good_ && sb_->sputn(p, static_cast<std::streamsize>(n)) == static_cast<std::streamsize>(n);
+  }
+  // false once a write has failed; later writes are dropped
+  bool good() const {
+    return good_;
+  }
+};
+
+// collects the output in a buffer of Size chars and passes it to a callback f(const char *, size_t) in chunks; runs
+// that do not fit are passed on directly.  Call flush() when done; the destructor flushes too.
+template <typename F, size_t Size = 4096> class callback_sink {
+  F f_;
+  char buf_[Size];
+  size_t len_;
+
+public:
+  explicit callback_sink(F f) : f_(f), len_(0) {
+  }
+  ~callback_sink() {
+    flush();
+  }
+  void put(char c) {
+    if (len_ == Size) {
+      flush();
+    }
+    buf_[len_++] = c;
+  }
+  void write(const char *p, size_t n) {
+    if (n > Size - len_) {
+      flush();
+      if (n >= Size) {
+        f_(p, n);
+        return;
+      }
+    }
+    std::memcpy(buf_ + len_, p, n);
+    len_ += n;
+  }
+  void flush() {
+    if (len_ != 0) {
+      f_(static_cast<const char *>(buf_), len_);
+      len_ = 0;
+    }
+  }
+
+private:
+  callback_sink(const callback_sink &);
+  callback_sink &operator=(const callback_sink &);
+};
+
+#ifdef PICORISON_USE_POSIX
+// Writes to a file descriptor through a buffer of Size chars.  A run that does not fit is written together with the
+// buffer by one writev.  Call flush() when done; the destructor flushes too.
+template <size_t Size = 16384> class basic_fd_sink {
+  int fd_;
+  char buf_[Size];
+  size_t len_;
+  bool good_;
+
+public:
+  explicit basic_fd_sink(int fd) : fd_(fd), len_(0), good_(true) {
+  }
+  ~basic_fd_sink() {
+    flush();
+  }
+  void put(char c) {
+    if (len_ == Size) {
+      flush();
+    }
+    buf_[len_++] = c;
+  }
+  void write(const char *p, size_t n) {
+    if (n <= Size - len_) {
+      std::memcpy(buf_ + len_, p, n);
+      len_ += n;
+      return;
+    }
+    struct iovec iov[2];
+    iov[0].iov_base = buf_;
+    iov[0].iov_len = len_;
+    iov[1].iov_base = const_cast<char *>(p);
+    iov[1].iov_len = n;
+    write_all(iov, 2);
+    len_ = 0;
+  }
+  void flush() {
+    if (len_ != 0) {
+      struct iovec iov;
+      iov.iov_base = buf_;
+      iov.iov_len = len_;
+      write_all(&iov, 1);
+      len_ = 0;
+    }
+  }
+  // false once a write has failed; errno tells why and later writes are dropped
+  bool good() const {
+    return good_;
+  }
+
+protected:
+  void write_all(struct iovec *iov, int cnt) {
+    while (good_ && cnt != 0) {
+      ssize_t r = ::writev(fd_, iov, cnt);
+      if (r < 0) {
+        good_ = errno == EINTR;
+        continue;
+      }
+      size_t done = static_cast<size_t>(r);
+      for (; cnt != 0 && done >= iov->iov_len; ++iov, --cnt) {
+        done -= iov->iov_len;
+      }
+      if (cnt != 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+        iov->iov_len -= done;
+      }
+    }
+  }
+
+private:
+  basic_fd_sink(const basic_fd_sink &);
+  basic_fd_sink &operator=(const basic_fd_sink &);
+};
+
+typedef basic_fd_sink<> fd_sink;
+#endif
+
+// Writes RISON to a sink without building a value, e.g.
+//   w.begin_object().key("q").string("it's").key("ids").begin_array().integer(1).integer(2).end().end();
+// writes (q:'it!'s',ids:!(1,2)); members are written in the order of the calls.  Separators, quoting and escaping are those of serialize.
+// A checked writer asserts (through PICORISON_ASSERT) that the calls form a single well-formed value.
+template <typename Sink> class basic_writer {
+protected:
+  Sink *sink_;
+  bool first_;              // no separator before the next item
+  bool after_key_;          // the next item is the value of a key
+  bool checked_;
+  std::vector<char> stack_; // when checked: 'a' or 'o' for each open container
+  bool done_;               // when checked: a complete value has been written
+
+public:
+  explicit basic_writer(Sink *sink, bool checked = false)
+      : sink_(sink), first_(true), after_key_(false), checked_(checked), stack_(), done_(false) {
+  }
+  // starts over, e.g. after the sink has been cleared
+  void reset() {
+    first_ = true;
+    after_key_ = false;
+    stack_.clear();
+    done_ = false;
+  }
+  basic_writer &begin_object() {
+    start_value();
+    sink_->put('(');
+    open('o');
+    return *this;
+  }
+  basic_writer &begin_array() {
+    start_value();
+    sink_->write("!(", 2);
+    open('a');
+    return *this;
+  }
+  basic_writer &end() {
+    if (checked_) {
+      PICORISON_ASSERT("end without an open container" && !stack_.empty());
+      PICORISON_ASSERT("key without a value" && !after_key_);
+      stack_.pop_back();
+    }
+    sink_->put(')');
+    end_value();
+    return *this;
+  }
+  basic_writer &key(const string_ref &k) {
+    if (checked_) {
+      PICORISON_ASSERT("key outside an object" && !stack_.empty() && stack_.back() == 'o');
+      PICORISON_ASSERT("key without a value" && !after_key_);
+    }
+    if (!first_) {
+      sink_->put(',');
+    }
+    sink_iterator<Sink> oi(sink_);
+    _serialize_str(k, oi);
+    sink_->put(':');
+    first_ = false;
+    after_key_ = true;
+    return *this;
+  }
+  basic_writer &string(const string_ref &s) {
+    start_value();
+    sink_iterator<Sink> oi(sink_);
+    _serialize_str(s, oi);
+    end_value();
+    return *this;
+  }
+  basic_writer &number(double f) {
+    PICORISON_ASSERT("number is not finite" && f - f == 0);
+    start_value();
+    char buf[32];
+    sink_->write(buf, _format_double(buf, f) - buf);
+    end_value();
+    return *this;
+  }
+  basic_writer &integer(int64_t i) {
+    start_value();
+    char buf[32];
+    sink_->write(buf, _format_int64(buf, i) - buf);
+    end_value();
+    return *this;
+  }
+  basic_writer &boolean(bool b) {
+    start_value();
+    sink_->write(b ? "!t" : "!f", 2);
+    end_value();
+    return *this;
+  }
+  basic_writer &null() {
+    start_value();
+    sink_->write("!n", 2);
+    end_value();
+    return *this;
+  }
+  // writes a value as serialize would
+  basic_writer &write(const value &v) {
+    start_value();
+    serialize(v, *sink_);
+    end_value();
+    return *this;
+  }
+  // when checked: whether a complete value has been written
+  bool complete() const {
+    return done_;
+  }
+
+protected:
+  void start_value() {
+    if (checked_) {
+      PICORISON_ASSERT("more than one value" && (!stack_.empty() || !done_));
+      PICORISON_ASSERT("value without a key" && (stack_.empty() || stack_.back() == 'a' || after_key_));
+    }
+    if (!first_ && !after_key_) {
+      sink_->put(',');
+    }
+  }
+  void end_value() {
+    first_ = false;
+    after_key_ = false;
+    done_ = checked_ && stack_.empty();
+  }
+  void open(char type) {
+    if (checked_) {
+      stack_.push_back(type);
+    }
+    first_ = true;
+    after_key_ = false;
+  }
+};
+
+typedef basic_writer<string_sink> writer;
+
+template <typename Iter> class input {
+protected:
+  Iter cur_, end_;
+  bool consumed_;
+  size_t offset_; // of cur_
+  const char *expected_;
+
+public:
+  input(const Iter &first, const Iter &last) : cur_(first), end_(last), consumed_(false), offset_(0), expected_(NULL) {
+  }
+  int getc() {
+    if (consumed_) {
+      ++cur_;
+      ++offset_;
+    }
+    if (cur_ == end_) {
+      consumed_ = false;
+      return -1;
+    }
+    consumed_ = true;
+    return *cur_ & 0xff;
+  }
+  void ungetc() {
+    consumed_ = false;
+  }
+  Iter cur() const {
+    if (consumed_) {
+      input<Iter> *self = const_cast<input<Iter> *>(this);
+      self->consumed_ = false;
+      ++self->cur_;
+      ++self->offset_;
+    }
+    return cur_;
+  }
+  // Neither the parser nor skip() reads past a control character, a newline included, so everything read before an
+  // error is on the first line; this is what lets the position be tracked as a plain offset.
+  int line() const {
+    return 1;
+  }
+  // of the last character read
+  void position(size_t &offset, int &line, int &column) const {
+    offset = offset_;
+    line = 1;
+    column = static_cast<int>(offset_) + 1;
+  }
+  // records what the parser expected when it failed; the innermost failure is kept
+  bool fail(const char *expected) {
+    if (expected_ == NULL) {
+      expected_ = expected;
+    }
+    return false;
+  }
+  const char *expected() const {
+    return expected_;
+  }
+  bool expect(const int expected) {
+    if (getc() != expected) {
+      ungetc();
+      return false;
+    }
+    return true;
+  }
+  bool match(const std::string &pattern) {
+    for (std::string::const_iterator pi(pattern.begin()); pi != pattern.end(); ++pi) {
+      if (getc() != *pi) {
+        ungetc();
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// specialization for contiguous buffers; works on raw pointers and counts lines only when asked
+template <typename Ch> class input<Ch *> {
+protected:
+  Ch *begin_, *cur_, *end_;
+  Ch *last_; // position returned by the last getc(), restored by ungetc()
+  const char *expected_;
+
+public:
+  input(Ch *first, Ch *last) : begin_(first), cur_(first), end_(last), last_(first), expected_(NULL) {
+  }
+  int getc() {
+    last_ = cur_;
+    if (cur_ == end_) {
+      return -1;
+    }
+    return *cur_++ & 0xff;
+  }
+  void ungetc() {
+    cur_ = last_;
+  }
+  Ch *cur() const {
+    return cur_;
+  }
+  int line() const {
+    return 1 + static_cast<int>(std::count(begin_, last_, '\n'));
+  }
+  // of the last character read, computed from the buffer so that the parse itself only moves pointers
+  void position(size_t &offset, int &line, int &column) const {
+    offset = last_ - begin_;
+    line = 1;
+    Ch *line_start = begin_;
+    for (Ch *p = begin_; p != last_; ++p) {
+      if (*p == '\n') {
+        ++line;
+        line_start = p + 1;
+      }
+    }
+    column = static_cast<int>(last_ - line_start) + 1;
+  }
+  bool fail(const char *expected) {
+    if (expected_ == NULL) {
+      expected_ = expected;
+    }
+    return false;
+  }
+  const char *expected() const {
+    return expected_;
+  }
+  bool expect(const int expected) {
+    last_ = cur_;
+    if (cur_ == end_ || (*cur_ & 0xff) != expected) {
+      return false;
+    }
+    ++cur_;
+    return true;
+  }
+  bool match(const std::string &pattern) {
+    for (std::string::const_iterator pi(pattern.begin()); pi != pattern.end(); ++pi) {
+      if (getc() != *pi) {
+        ungetc();
+        return false;
+      }
     }
     return true;
   }
+  // direct access for the scanners below
+  int peek() const {
+    return cur_ != end_ ? *cur_ & 0xff : -1;
+  }
+  Ch *end() const {
+    return end_;
+  }
+  void seek(Ch *p) {
+    cur_ = last_ = p;
+  }
 };
 
+template <typename String, typename Ch> inline void _append_run(String &out, Ch *first, Ch *last) {
+  for (; first != last; ++first) {
+    out.push_back(static_cast<char>(*first));
+  }
+}
+
+template <typename Ch> inline void _append_run(std::string &out, Ch *first, Ch *last) {
+  out.append(reinterpret_cast<const char *>(first), last - first);
+}
+
 template <typename String, typename Iter> inline bool _parse_string(String &out, input<Iter> &in) {
   while (1) {
     int ch = in.getc();
     if (ch < ' ') {
       in.ungetc();
-      return false;
+      return in.fail("a closing quote");
     } else if (ch == '\'') {
       return true;
     } else if (ch == '!') {
       // Escaped char
       if ((ch = in.getc()) == -1) {
-        return false;
+        return in.fail("an escape (!! or !')");
       }
       switch (ch) {
       case '!':
@@ -656,7 +1731,7 @@ template <typename String, typename Iter> inline bool _parse_string(String &out,
         out.push_back(ch);
         break;
       default:
-        return false;
+        return in.fail("an escape (!! or !')");
       }
     } else {
       out.push_back(static_cast<char>(ch));
@@ -665,15 +1740,39 @@ template <typename String, typename Iter> inline bool _parse_string(String &out,
   return false;
 }
 
+template <typename String, typename Ch> inline bool _parse_string(String &out, input<Ch *> &in) {
+  while (1) {
+    Ch *special = _find_string_special(in.cur(), in.end());
+    _append_run(out, in.cur(), special);
+    in.seek(special);
+    int ch = in.getc();
+    if (ch == '\'') {
+      return true;
+    } else if (ch != '!') {
+      in.ungetc();
+      return in.fail("a closing quote");
+    }
+    // Escaped char
+    switch (ch = in.getc()) {
+    case '!':
+    case '\'':
+      out.push_back(static_cast<char>(ch));
+      break;
+    default:
+      return in.fail("an escape (!! or !')");
+    }
+  }
+}
+
 template <typename String, typename Iter> inline bool _parse_id(String &out, input<Iter> &in) {
-  int ch = *in.cur();
-  if (std::isdigit(ch) || ch == '-') {
+  int ch = in.getc();
+  in.ungetc();
+  if (ch != -1 && (char_class(ch) & id_start_reject_class)) {
     return false;
   }
-  const std::set<char> allowed_graph {'-', '_', '.', '/', '~'};
   while (1) {
     ch = in.getc();
-    if (!std::isalnum(ch) && !allowed_graph.count(static_cast<char>(ch))) {
+    if (ch == -1 || !(char_class(ch) & id_char_class)) {
       in.ungetc();
       break;
     }
@@ -682,6 +1781,17 @@ template <typename String, typename Iter> inline bool _parse_id(String &out, inp
   return true;
 }
 
+template <typename String, typename Ch> inline bool _parse_id(String &out, input<Ch *> &in) {
+  int ch = in.peek();
+  if (ch != -1 && (char_class(ch) & id_start_reject_class)) {
+    return false;
+  }
+  Ch *last = _find_id_end(in.cur(), in.end());
+  _append_run(out, in.cur(), last);
+  in.seek(last);
+  return true;
+}
+
 template <typename Context, typename Iter> inline bool _parse_array(Context &ctx, input<Iter> &in) {
   if (!ctx.parse_array_start()) {
     return false;
@@ -696,7 +1806,34 @@ template <typename Context, typename Iter> inline bool _parse_array(Context &ctx
     }
     idx++;
   } while (in.expect(','));
-  return in.expect(')') && ctx.parse_array_stop(idx);
+  if (!in.expect(')')) {
+    return in.fail("',' or ')'");
+  }
+  return ctx.parse_array_stop(idx);
+}
+
+// _parse_object_item and _parse_id_value are found through ADL; a context may overload them for its own type to
+// receive keys and ids without copying them into a std::string (see borrowed_parse_context)
+template <typename Context, typename Iter> inline bool _parse_object_item(Context &ctx, input<Iter> &in) {
+  std::string key;
+  bool parsed_key = false;
+  if (in.expect('\'')) {
+    parsed_key = _parse_string(key, in);
+  } else {
+    parsed_key = _parse_id(key, in);
+  }
+  if (parsed_key && !in.expect(':')) {
+    return in.fail("':'");
+  }
+  return ctx.parse_object_item(in, key);
+}
+
+template <typename Context, typename Iter> inline bool _parse_id_value(Context &ctx, input<Iter> &in) {
+  std::string id;
+  if (_parse_id(id, in)) {
+    return ctx.set_string(id);
+  }
+  return false;
 }
 
 template <typename Context, typename Iter> inline bool _parse_object(Context &ctx, input<Iter> &in) {
@@ -707,101 +1844,217 @@ template <typename Context, typename Iter> inline bool _parse_object(Context &ct
     return true;
   }
   do {
-    std::string key;
-    bool parsed_key = false;
-    if (in.expect('\'')) {
-      parsed_key = _parse_string(key, in);
-    } else {
-      parsed_key = _parse_id(key, in);
-    }
-    if (parsed_key && !in.expect(':')) {
-      return false;
-    }
-    if (!ctx.parse_object_item(in, key)) {
+    if (!_parse_object_item(ctx, in)) {
       return false;
     }
   } while (in.expect(','));
-  return in.expect(')');
+  return in.expect(')') || in.fail("',' or ')'");
 }
 
-template <typename Iter> inline std::string _parse_number(input<Iter> &in) {
-  std::string num_str;
-  while (1) {
-    int ch = in.getc();
-    if (('0' <= ch && ch <= '9') || ch == '-' || ch == 'e') {
-      num_str.push_back(static_cast<char>(ch));
-    } else if (ch == '.') {
-      num_str.push_back('.');
+// holds the text of a number token for the strtod fallback; spills to the heap only for very long tokens
+class _number_text {
+  char buf_[64];
+  size_t len_;
+  std::string spill_;
+
+public:
+  _number_text() : len_(0), spill_() {
+  }
+  void push_back(int ch) {
+    if (len_ < sizeof(buf_) - 1) {
+      buf_[len_++] = static_cast<char>(ch);
     } else {
-      in.ungetc();
-      break;
+      if (spill_.empty()) {
+        spill_.assign(buf_, len_);
+      }
+      spill_.push_back(static_cast<char>(ch));
+    }
+  }
+  double to_double() {
+    char *p = buf_;
+    if (!spill_.empty()) {
+      p = &spill_[0];
+    } else {
+      buf_[len_] = '\0';
     }
+    // strtod expects the decimal point of the current locale
+    const char point = *localeconv()->decimal_point;
+    if (point != '.') {
+      std::replace(p, p + std::strlen(p), '.', point);
+    }
+    return strtod(p, NULL);
   }
-  return num_str;
+};
+
+inline bool _is_number_char(int ch) {
+  return ('0' <= ch && ch <= '9') || ch == '-' || ch == '.' || ch == 'e';
 }
 
-template <typename Context, typename Iter> inline bool _parse(Context &ctx, input<Iter> &in) {
-  int ch = in.getc();
-  switch (ch) {
-  case '!':                                                                                                                         \
-    switch (in.getc()) {
-    case 'n':
-      ctx.set_null();
-      return true;
-    case 'f':
-      ctx.set_bool(false);
-      return true;
-    case 't':
-      ctx.set_bool(true);
-      return true;
-    case '(':
-      return _parse_array(ctx, in);
-    default:
-      return false;
+// converts m * 10^e exactly when both operands are exactly representable (Clinger's fast path)
+inline bool _fast_decimal_to_double(uint64_t m, int e, double &f) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const uint64_t max_exact = uint64_t(1) << 53;
+  if (m > max_exact) {
+    return false;
+  }
+  if (e > 22 && e <= 22 + 15) {
+    // move the excess into the mantissa while it stays exact, e.g. 123e25 == 123000e22
+    for (; e > 22 && m <= max_exact / 10; --e) {
+      m *= 10;
     }
-  case '\'':
-    return ctx.parse_string(in);
-  case '(':
-    return _parse_object(ctx, in);
-  default:
-    if (('0' <= ch && ch <= '9') || ch == '-') {
-      double f;
-      char *endp;
-      in.ungetc();
-      std::string num_str(_parse_number(in));
-      if (num_str.empty()) {
-        return false;
+  }
+  if (e < -22 || e > 22) {
+    return false;
+  }
+  f = static_cast<double>(m);
+  if (e < 0) {
+    f /= pow10[-e];
+  } else {
+    f *= pow10[e];
+  }
+  return true;
+#else
+  (void)m;
+  (void)e;
+  (void)f;
+  return false;
+#endif
+}
+
+// parses -?[0-9]*(\.[0-9]*)?(e-?[0-9]+)? in place; the token must contain at least one mantissa digit
+template <typename Context, typename Iter> inline bool _parse_number(Context &ctx, input<Iter> &in) {
+  _number_text text;
+  uint64_t mantissa = 0;   // first 19 significant digits
+  int digits = 0;          // digits stored in mantissa
+  int exp10 = 0;           // decimal exponent of the mantissa's last digit
+  bool truncated = false;  // a nonzero digit did not fit in the mantissa
+  uint64_t integer = 0;    // the integer part, for the int64 path
+  bool integer_overflow = false;
+  bool negative = false, fraction = false, exponent = false, mantissa_digit = false;
+
+  int ch = in.getc();
+  if (ch == '-') {
+    negative = true;
+    text.push_back(ch);
+    ch = in.getc();
+  }
+  for (;; ch = in.getc()) {
+    if ('0' <= ch && ch <= '9') {
+      int d = ch - '0';
+      mantissa_digit = true;
+      if (!fraction) {
+        if (integer > (std::numeric_limits<uint64_t>::max() - d) / 10) {
+          integer_overflow = true;
+        }
+        integer = integer * 10 + d;
       }
-#ifdef PICORISON_USE_INT64
-      {
-        errno = 0;
-        intmax_t ival = strtoimax(num_str.c_str(), &endp, 10);
-        if (errno == 0 && std::numeric_limits<int64_t>::min() <= ival && ival <= std::numeric_limits<int64_t>::max() &&
-            endp == num_str.c_str() + num_str.size()) {
-          ctx.set_int64(ival);
-          return true;
+      if (digits == 0 && d == 0) {
+        // leading zero
+        if (fraction) {
+          --exp10;
+        }
+      } else if (digits < 19) {
+        mantissa = mantissa * 10 + d;
+        ++digits;
+        if (fraction) {
+          --exp10;
+        }
+      } else {
+        truncated |= d != 0;
+        if (!fraction) {
+          ++exp10;
         }
       }
-#endif
-      f = strtod(num_str.c_str(), &endp);
-      if (endp == num_str.c_str() + num_str.size()) {
-        ctx.set_number(f);
-        return true;
+    } else if (ch == '.' && !fraction) {
+      fraction = true;
+    } else {
+      break;
+    }
+    text.push_back(ch);
+  }
+  bool valid = mantissa_digit;
+  if (ch == 'e' && valid) {
+    exponent = true;
+    text.push_back(ch);
+    bool exp_negative = false;
+    int exp_value = 0;
+    if ((ch = in.getc()) == '-') {
+      exp_negative = true;
+      text.push_back(ch);
+      ch = in.getc();
+    }
+    valid = false;
+    for (; '0' <= ch && ch <= '9'; ch = in.getc()) {
+      if (exp_value < 100000) {
+        exp_value = exp_value * 10 + (ch - '0');
       }
-      return false;
+      valid = true;
+      text.push_back(ch);
+    }
+    exp10 += exp_negative ? -exp_value : exp_value;
+  }
+  if (!valid || _is_number_char(ch)) {
+    // the token as a whole is not a number; consume the rest of it
+    while (_is_number_char(ch)) {
+      ch = in.getc();
+    }
+    in.ungetc();
+    return in.fail("a number");
+  }
+  in.ungetc();
+
+#ifdef PICORISON_USE_INT64
+  if (!fraction && !exponent && !integer_overflow &&
+      integer <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + (negative ? 1 : 0)) {
+    return ctx.set_int64(negative ? static_cast<int64_t>(0 - integer) : static_cast<int64_t>(integer));
+  }
+#else
+  (void)integer_overflow;
+  (void)exponent;
+#endif
+  double f;
+  if (mantissa == 0) {
+    f = 0;
+  } else if (truncated || !_fast_decimal_to_double(mantissa, exp10, f)) {
+    return ctx.set_number(text.to_double());
+  }
+  return ctx.set_number(negative ? -f : f);
+}
+
+template <typename Context, typename Iter> inline bool _parse(Context &ctx, input<Iter> &in) {
+  int ch = in.getc();
+  switch (ch) {
+  case '!':                                                                                                                         \
+    switch (in.getc()) {
+    case 'n':
+      return ctx.set_null();
+    case 'f':
+      return ctx.set_bool(false);
+    case 't':
+      return ctx.set_bool(true);
+    case '(':
+      return _parse_array(ctx, in);
+    default:
+      return in.fail("'n', 't', 'f' or '(' after '!'");
+    }
+  case '\'':
+    return ctx.parse_string(in);
+  case '(':
+    return _parse_object(ctx, in);
+  default:
+    if (('0' <= ch && ch <= '9') || ch == '-') {
+      in.ungetc();
+      return _parse_number(ctx, in);
     } else {
-      if (std::iscntrl(ch)) {
-        return false;
+      if (ch != -1 && (char_class(ch) & control_char_class)) {
+        return in.fail("a value");
       }
 
       // parse as id token
       in.ungetc();
-      std::string id;
-      if (_parse_id(id, in)) {
-        ctx.set_string(id);
-        return true;
-      }
-      return false;
+      return _parse_id_value(ctx, in);
     }
     break;
   }
@@ -809,234 +2062,3245 @@ template <typename Context, typename Iter> inline bool _parse(Context &ctx, inpu
   return false;
 }
 
-class deny_parse_context {
+class deny_parse_context {
+public:
+  bool set_null() {
+    return false;
+  }
+  bool set_bool(bool) {
+    return false;
+  }
+#ifdef PICORISON_USE_INT64
+  bool set_int64(int64_t) {
+    return false;
+  }
+#endif
+  bool set_number(double) {
+    return false;
+  }
+  bool set_string(const std::string &) {
+    return false;
+  }
+  template <typename Iter> bool parse_string(input<Iter> &) {
+    return false;
+  }
+  bool parse_array_start() {
+    return false;
+  }
+  template <typename Iter> bool parse_array_item(input<Iter> &, size_t) {
+    return false;
+  }
+  bool parse_array_stop(size_t) {
+    return false;
+  }
+  bool parse_object_start() {
+    return false;
+  }
+  template <typename Iter> bool parse_object_item(input<Iter> &, const std::string &) {
+    return false;
+  }
+};
+
+class default_parse_context {
+protected:
+  value *out_;
+
+public:
+  default_parse_context(value *out) : out_(out) {
+  }
+  bool set_null() {
+    *out_ = value();
+    return true;
+  }
+  bool set_bool(bool b) {
+    *out_ = value(b);
+    return true;
+  }
+#ifdef PICORISON_USE_INT64
+  bool set_int64(int64_t i) {
+    *out_ = value(i);
+    return true;
+  }
+#endif
+  bool set_number(double f) {
+    *out_ = value(f);
+    return true;
+  }
+  bool set_string(const std::string &s) {
+    *out_ = value(s);
+    return true;
+  }
+  template <typename Iter> bool parse_string(input<Iter> &in) {
+    // TODO: use set_string()
+    *out_ = value(string_type, false);
+    return _parse_string(out_->get<std::string>(), in);
+  }
+  bool parse_array_start() {
+    *out_ = value(array_type, false);
+    return true;
+  }
+  template <typename Iter> bool parse_array_item(input<Iter> &in, size_t) {
+    array &a = out_->get<array>();
+    a.push_back(value());
+    default_parse_context ctx(&a.back());
+    return _parse(ctx, in);
+  }
+  bool parse_array_stop(size_t) {
+    return true;
+  }
+  bool parse_object_start() {
+    *out_ = value(object_type, false);
+    return true;
+  }
+  template <typename Iter> bool parse_object_item(input<Iter> &in, const std::string &key) {
+    object &o = out_->get<object>();
+    default_parse_context ctx(&o[key]);
+    return _parse(ctx, in);
+  }
+
+private:
+  default_parse_context(const default_parse_context &);
+  default_parse_context &operator=(const default_parse_context &);
+};
+
+// Builds a value as a handler for event_parser and basic_push_parser.  An event handler provides the following member
+// functions, each returning false to stop the parse with an error:
+//   on_null(), on_bool(bool), on_number(double), on_int64(int64_t) (if PICORISON_USE_INT64 is defined), on_string(string_ref),
+//   on_start_array(), on_end_array(size_t), on_start_object(), on_key(string_ref), on_end_object(size_t)
+// Strings and keys passed to the handler are only valid during the call.
+// parse() keeps building values with the recursive default_parse_context, which works with any iterator and needs no
+// stack of its own; value_handler is the event-driven equivalent for the non-recursive parsers.
+class value_handler {
+protected:
+  value *out_;
+  std::vector<value *> stack_; // open containers
+  value *member_;              // the value of the last key
+
+public:
+  value_handler(value *out) : out_(out), stack_(), member_(NULL) {
+  }
+  bool on_null() {
+    *next() = value();
+    return true;
+  }
+  bool on_bool(bool b) {
+    *next() = value(b);
+    return true;
+  }
+#ifdef PICORISON_USE_INT64
+  bool on_int64(int64_t i) {
+    *next() = value(i);
+    return true;
+  }
+#endif
+  bool on_number(double f) {
+    *next() = value(f);
+    return true;
+  }
+  bool on_string(const string_ref &s) {
+    *next() = value(s.data(), s.size());
+    return true;
+  }
+  bool on_start_array() {
+    return start(array_type);
+  }
+  bool on_end_array(size_t) {
+    stack_.pop_back();
+    return true;
+  }
+  bool on_start_object() {
+    return start(object_type);
+  }
+  bool on_key(const string_ref &key) {
+    member_ = &stack_.back()->get<object>()[key.str()];
+    return true;
+  }
+  bool on_end_object(size_t) {
+    stack_.pop_back();
+    return true;
+  }
+  // forgets the containers left open by a failed parse
+  void reset() {
+    stack_.clear();
+    member_ = NULL;
+  }
+
+protected:
+  value *next() {
+    if (member_ != NULL) {
+      value *v = member_;
+      member_ = NULL;
+      return v;
+    } else if (stack_.empty()) {
+      return out_;
+    }
+    array &a = stack_.back()->get<array>();
+    a.push_back(value());
+    return &a.back();
+  }
+  bool start(int type) {
+    value *v = next();
+    *v = value(type, false);
+    stack_.push_back(v);
+    return true;
+  }
+
+private:
+  value_handler(const value_handler &);
+  value_handler &operator=(const value_handler &);
+};
+
+class null_parse_context {
+public:
+  struct dummy_str {
+    void push_back(int) {
+    }
+  };
+
+public:
+  null_parse_context() {
+  }
+  bool set_null() {
+    return true;
+  }
+  bool set_bool(bool) {
+    return true;
+  }
+#ifdef PICORISON_USE_INT64
+  bool set_int64(int64_t) {
+    return true;
+  }
+#endif
+  bool set_number(double) {
+    return true;
+  }
+  bool set_string(const std::string &) {
+    return true;
+  }
+  template <typename Iter> bool parse_string(input<Iter> &in) {
+    dummy_str s;
+    return _parse_string(s, in);
+  }
+  bool parse_array_start() {
+    return true;
+  }
+  template <typename Iter> bool parse_array_item(input<Iter> &in, size_t) {
+    return _parse(*this, in);
+  }
+  bool parse_array_stop(size_t) {
+    return true;
+  }
+  bool parse_object_start() {
+    return true;
+  }
+  template <typename Iter> bool parse_object_item(input<Iter> &in, const std::string &) {
+    return _parse(*this, in);
+  }
+
+private:
+  null_parse_context(const null_parse_context &);
+  null_parse_context &operator=(const null_parse_context &);
+};
+
+// obsolete, use the version below
+template <typename Iter> inline std::string parse(value &out, Iter &pos, const Iter &last) {
+  std::string err;
+  pos = parse(out, pos, last, &err);
+  return err;
+}
+
+// where and why a parse failed
+struct parse_error {
+  size_t offset;        // in characters from the start of the input
+  int line;             // 1-based
+  int column;           // 1-based, in characters
+  std::string expected; // what the parser expected at the position, if known
+  std::string message;  // as reported through the std::string interfaces
+
+  parse_error() : offset(0), line(0), column(0), expected(), message() {
+  }
+};
+
+template <typename Iter> inline void _set_error(input<Iter> &in, std::string *err, const char *what = "syntax error") {
+  char buf[96];
+  SNPRINTF(buf, sizeof(buf), "%s at line %d near: ", what, in.line());
+  *err = buf;
+  while (1) {
+    int ch = in.getc();
+    if (ch == -1 || ch == '\n') {
+      break;
+    } else if (ch >= ' ') {
+      err->push_back(static_cast<char>(ch));
+    }
+  }
+}
+
+template <typename Iter> inline void _set_error(input<Iter> &in, parse_error &err) {
+  in.position(err.offset, err.line, err.column);
+  err.expected = in.expected() != NULL ? in.expected() : "";
+  _set_error(in, &err.message);
+}
+
+template <typename Context, typename Iter> inline Iter _parse(Context &ctx, const Iter &first, const Iter &last, std::string *err) {
+  input<Iter> in(first, last);
+  if (!_parse(ctx, in) && err != NULL) {
+    _set_error(in, err);
+  }
+  return in.cur();
+}
+
+// reports errors with their position; the position is only computed when parsing fails
+template <typename Context, typename Iter> inline Iter _parse(Context &ctx, const Iter &first, const Iter &last, parse_error &err) {
+  input<Iter> in(first, last);
+  err = parse_error();
+  if (!_parse(ctx, in)) {
+    _set_error(in, err);
+  }
+  return in.cur();
+}
+
+template <typename Iter> inline Iter parse(value &out, const Iter &first, const Iter &last, std::string *err) {
+  default_parse_context ctx(&out);
+  return _parse(ctx, first, last, err);
+}
+
+template <typename Iter> inline Iter parse(value &out, const Iter &first, const Iter &last, parse_error &err) {
+  default_parse_context ctx(&out);
+  return _parse(ctx, first, last, err);
+}
+
+inline std::string parse(value &out, const std::string &s) {
+  std::string err;
+  parse(out, s.data(), s.data() + s.size(), &err);
+  return err;
+}
+
+inline std::string parse(value &out, std::istream &is) {
+  std::string err;
+  parse(out, std::istreambuf_iterator<char>(is.rdbuf()), std::istreambuf_iterator<char>(), &err);
+  return err;
+}
+
+template <typename T> struct last_error_t { static std::string s; };
+template <typename T> std::string last_error_t<T>::s;
+
+inline void set_last_error(const std::string &s) {
+  last_error_t<bool>::s = s;
+}
+
+inline const std::string &get_last_error() {
+  return last_error_t<bool>::s;
+}
+
+inline bool operator==(const value &x, const value &y) {
+  if (x.is<null>())
+    return y.is<null>();
+#define PICORISON_CMP(type)                                                                                                         \
+  if (x.is<type>())                                                                                                                \
+  return y.is<type>() && x.get<type>() == y.get<type>()
+  PICORISON_CMP(bool);
+  PICORISON_CMP(double);
+  PICORISON_CMP(std::string);
+  PICORISON_CMP(array);
+  PICORISON_CMP(object);
+#undef PICORISON_CMP
+  PICORISON_ASSERT(0);
+#ifdef _MSC_VER
+  __assume(0);
+#endif
+  return false;
+}
+
+inline bool operator!=(const value &x, const value &y) {
+  return !(x == y);
+}
+
+// a read-only value whose strings and keys refer to the input buffer whenever they contain no escapes;
+// arrays, objects and unescaped strings live in the arena of the borrowed_document the value belongs to
+class borrowed_value {
+public:
+  typedef std::pair<string_ref, borrowed_value> member;
+  template <typename T> class range {
+  protected:
+    const T *begin_, *end_;
+
+  public:
+    typedef const T *const_iterator;
+    range() : begin_(NULL), end_(NULL) {
+    }
+    range(const T *first, size_t size) : begin_(first), end_(first + size) {
+    }
+    const_iterator begin() const {
+      return begin_;
+    }
+    const_iterator end() const {
+      return end_;
+    }
+    size_t size() const {
+      return end_ - begin_;
+    }
+    bool empty() const {
+      return begin_ == end_;
+    }
+    const T &operator[](size_t idx) const {
+      return begin_[idx];
+    }
+  };
+  typedef range<borrowed_value> array;
+  typedef range<member> object; // members in input order
+
+protected:
+  int type_;
+  union _storage {
+    bool boolean_;
+    double number_;
+#ifdef PICORISON_USE_INT64
+    int64_t int64_;
+#endif
+    struct {
+      const char *data_;
+      size_t size_;
+    } string_;
+    struct {
+      const borrowed_value *items_;
+      size_t size_;
+    } array_;
+    struct {
+      const member *items_;
+      size_t size_;
+    } object_;
+  } u_;
+
+public:
+  borrowed_value() : type_(null_type), u_() {
+  }
+  explicit borrowed_value(bool b) : type_(boolean_type), u_() {
+    u_.boolean_ = b;
+  }
+#ifdef PICORISON_USE_INT64
+  explicit borrowed_value(int64_t i) : type_(int64_type), u_() {
+    u_.int64_ = i;
+  }
+#endif
+  explicit borrowed_value(double n) : type_(number_type), u_() {
+    u_.number_ = n;
+  }
+  explicit borrowed_value(const string_ref &s) : type_(string_type), u_() {
+    u_.string_.data_ = s.data();
+    u_.string_.size_ = s.size();
+  }
+  explicit borrowed_value(const array &a) : type_(array_type), u_() {
+    u_.array_.items_ = a.begin();
+    u_.array_.size_ = a.size();
+  }
+  explicit borrowed_value(const object &o) : type_(object_type), u_() {
+    u_.object_.items_ = o.begin();
+    u_.object_.size_ = o.size();
+  }
+  template <typename T> bool is() const;
+  template <typename T> T get() const;
+  const borrowed_value &get(const size_t idx) const;
+  const borrowed_value &get(const string_ref &key) const;
+  bool contains(const size_t idx) const;
+  bool contains(const string_ref &key) const;
+  value to_value() const;
+
+private:
+  template <typename T> borrowed_value(const T *); // intentionally defined to block implicit conversion of pointer to bool
+  const member *find(const string_ref &key) const;
+};
+
+#define IS(ctype, jtype)                                                                                                           \
+  template <> inline bool borrowed_value::is<ctype>() const {                                                                      \
+    return type_ == jtype##_type;                                                                                                  \
+  }
+IS(null, null)
+IS(bool, boolean)
+#ifdef PICORISON_USE_INT64
+IS(int64_t, int64)
+#endif
+IS(string_ref, string)
+IS(borrowed_value::array, array)
+IS(borrowed_value::object, object)
+#undef IS
+template <> inline bool borrowed_value::is<double>() const {
+  return type_ == number_type
+#ifdef PICORISON_USE_INT64
+         || type_ == int64_type
+#endif
+      ;
+}
+
+#define GET(ctype, var)                                                                                                            \
+  template <> inline ctype borrowed_value::get<ctype>() const {                                                                    \
+    PICORISON_ASSERT("type mismatch! call is<type>() before get<type>()" && is<ctype>());                                           \
+    return var;                                                                                                                    \
+  }
+GET(bool, u_.boolean_)
+GET(string_ref, string_ref(u_.string_.data_, u_.string_.size_))
+GET(borrowed_value::array, array(u_.array_.items_, u_.array_.size_))
+GET(borrowed_value::object, object(u_.object_.items_, u_.object_.size_))
+#ifdef PICORISON_USE_INT64
+GET(double, type_ == int64_type ? static_cast<double>(u_.int64_) : u_.number_)
+GET(int64_t, u_.int64_)
+#else
+GET(double, u_.number_)
+#endif
+#undef GET
+
+inline const borrowed_value::member *borrowed_value::find(const string_ref &key) const {
+  PICORISON_ASSERT(is<object>());
+  // the last occurrence wins, as it does when parsing into value
+  for (const member *i = u_.object_.items_ + u_.object_.size_; i != u_.object_.items_;) {
+    if ((--i)->first == key) {
+      return i;
+    }
+  }
+  return NULL;
+}
+
+inline const borrowed_value &borrowed_value::get(const size_t idx) const {
+  static borrowed_value s_null;
+  PICORISON_ASSERT(is<array>());
+  return idx < u_.array_.size_ ? u_.array_.items_[idx] : s_null;
+}
+
+inline const borrowed_value &borrowed_value::get(const string_ref &key) const {
+  static borrowed_value s_null;
+  const member *i = find(key);
+  return i != NULL ? i->second : s_null;
+}
+
+inline bool borrowed_value::contains(const size_t idx) const {
+  PICORISON_ASSERT(is<array>());
+  return idx < u_.array_.size_;
+}
+
+inline bool borrowed_value::contains(const string_ref &key) const {
+  return find(key) != NULL;
+}
+
+inline value borrowed_value::to_value() const {
+  switch (type_) {
+  case boolean_type:
+    return value(u_.boolean_);
+  case number_type:
+    return value(u_.number_);
+#ifdef PICORISON_USE_INT64
+  case int64_type:
+    return value(u_.int64_);
+#endif
+  case string_type:
+    return value(u_.string_.data_, u_.string_.size_);
+  case array_type: {
+    value v(array_type, false);
+    picorison::array &a = v.get<picorison::array>();
+    a.reserve(u_.array_.size_);
+    for (size_t i = 0; i != u_.array_.size_; ++i) {
+      a.push_back(u_.array_.items_[i].to_value());
+    }
+    return v;
+  }
+  case object_type: {
+    value v(object_type, false);
+    picorison::object &o = v.get<picorison::object>();
+    for (size_t i = 0; i != u_.object_.size_; ++i) {
+      o[u_.object_.items_[i].first.str()] = u_.object_.items_[i].second.to_value();
+    }
+    return v;
+  }
+  default:
+    return value();
+  }
+}
+
+// a monotonic allocator; memory is handed out from large chunks and released all at once.  Used by borrowed_document;
+// picorison::value does not allocate from it
+class arena {
+protected:
+  struct chunk {
+    chunk *next_;
+    size_t size_;
+  };
+  chunk *head_;
+  char *cur_, *end_;
+  size_t next_size_;
+
+public:
+  explicit arena(size_t initial_size = 4096) : head_(NULL), cur_(NULL), end_(NULL), next_size_(initial_size) {
+  }
+  ~arena() {
+    release();
+  }
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    char *p = align_up(cur_, align);
+    if (p == NULL || static_cast<size_t>(end_ - p) < size) {
+      grow(size + align);
+      p = align_up(cur_, align);
+    }
+    cur_ = p + size;
+    return p;
+  }
+  template <typename T> T *allocate_array(size_t n) {
+    return static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+  }
+  string_ref copy(const string_ref &s) {
+    char *p = static_cast<char *>(allocate(s.size(), 1));
+    std::memcpy(p, s.data(), s.size());
+    return string_ref(p, s.size());
+  }
+  // frees everything at once; memory spread over several chunks is replaced by a single chunk of the same total
+  // size, so that reusing the arena for a similar workload does not allocate
+  void clear() {
+    if (head_ == NULL) {
+      return;
+    }
+    if (head_->next_ != NULL) {
+      size_t total = capacity();
+      release();
+      head_ = NULL;
+      next_size_ = total;
+      grow(total);
+    }
+    cur_ = reinterpret_cast<char *>(head_ + 1);
+  }
+  size_t capacity() const {
+    size_t n = 0;
+    for (chunk *c = head_; c != NULL; c = c->next_) {
+      n += c->size_;
+    }
+    return n;
+  }
+
+protected:
+  static char *align_up(char *p, size_t align) {
+    return p == NULL ? NULL : reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(p) + align - 1) & ~(align - 1));
+  }
+  void grow(size_t min_size) {
+    size_t size = std::max(next_size_, min_size);
+    chunk *c = static_cast<chunk *>(::operator new(sizeof(chunk) + size));
+    c->next_ = head_;
+    c->size_ = size;
+    head_ = c;
+    cur_ = reinterpret_cast<char *>(c + 1);
+    end_ = cur_ + size;
+    next_size_ = std::min(size * 2, size_t(1) << 20);
+  }
+  // frees every chunk; head_ is left dangling
+  void release() {
+    chunk *c = head_;
+    while (c != NULL) {
+      chunk *next = c->next_;
+      ::operator delete(c);
+      c = next;
+    }
+  }
+
+private:
+  arena(const arena &);
+  arena &operator=(const arena &);
+};
+
+struct _string_ref_hash {
+  size_t operator()(const string_ref &s) const {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (const char *p = s.begin(); p != s.end(); ++p) {
+      h = (h ^ static_cast<unsigned char>(*p)) * 1099511628211ull;
+    }
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+};
+
+// Deduplicates strings into atoms: interning equal strings yields the same string_ref, whose characters live as long as
+// the table.  A table created as concurrent may be shared by threads; it is split into shards with a lock each.  Otherwise
+// it must only be used by one thread at a time (e.g. one table per thread).
+class intern_table {
+public:
+  struct stats {
+    size_t hits;   // strings found in the table
+    size_t misses; // strings added to the table
+    size_t size;   // number of atoms
+    size_t bytes;  // memory held for the characters of the atoms
+  };
+
+protected:
+  enum { num_shards = 16 };
+  struct shard {
+    std::unordered_set<string_ref, _string_ref_hash> atoms_;
+    arena storage_;
+    size_t hits_, misses_;
+#ifdef PICORISON_USE_THREADS
+    std::mutex mutex_;
+#endif
+    shard() : atoms_(), storage_(1024), hits_(0), misses_(0) {
+    }
+  };
+  shard shards_[num_shards];
+  bool concurrent_;
+
+public:
+  explicit intern_table(bool concurrent = false) : concurrent_(concurrent) {
+#ifndef PICORISON_USE_THREADS
+    PICORISON_ASSERT("concurrent intern tables need threads" && !concurrent);
+#endif
+  }
+  string_ref intern(const string_ref &s) {
+    shard &sh = shards_[_string_ref_hash()(s) % num_shards];
+    lock(sh);
+    std::unordered_set<string_ref, _string_ref_hash>::const_iterator i = sh.atoms_.find(s);
+    string_ref atom;
+    if (i != sh.atoms_.end()) {
+      ++sh.hits_;
+      atom = *i;
+    } else {
+      ++sh.misses_;
+      atom = sh.storage_.copy(s);
+      sh.atoms_.insert(atom);
+    }
+    unlock(sh);
+    return atom;
+  }
+  stats get_stats() {
+    stats st = {0, 0, 0, 0};
+    for (size_t i = 0; i != num_shards; ++i) {
+      lock(shards_[i]);
+      st.hits += shards_[i].hits_;
+      st.misses += shards_[i].misses_;
+      st.size += shards_[i].atoms_.size();
+      st.bytes += shards_[i].storage_.capacity();
+      unlock(shards_[i]);
+    }
+    return st;
+  }
+  // invalidates all atoms; must not be called while the table is in use by other threads
+  void clear() {
+    for (size_t i = 0; i != num_shards; ++i) {
+      shards_[i].atoms_.clear();
+      shards_[i].storage_.clear();
+      shards_[i].hits_ = shards_[i].misses_ = 0;
+    }
+  }
+
+protected:
+  void lock(shard &sh) {
+#ifdef PICORISON_USE_THREADS
+    if (concurrent_) {
+      sh.mutex_.lock();
+    }
+#else
+    (void)sh;
+#endif
+  }
+  void unlock(shard &sh) {
+#ifdef PICORISON_USE_THREADS
+    if (concurrent_) {
+      sh.mutex_.unlock();
+    }
+#else
+    (void)sh;
+#endif
+  }
+
+private:
+  intern_table(const intern_table &);
+  intern_table &operator=(const intern_table &);
+};
+
+// owns everything a borrowed_value tree needs except for the input buffer, which must outlive the document
+class borrowed_document {
+  friend class borrowed_parse_context;
+  friend const char *parse(borrowed_document &doc, const char *first, const char *last, std::string *err);
+
+protected:
+  borrowed_value root_;
+  arena arena_; // arrays, objects and unescaped strings; nodes are trivially destructible
+  // children of the containers being parsed, shared by all nesting levels
+  std::vector<borrowed_value> item_stack_;
+  std::vector<borrowed_value::member> member_stack_;
+  std::string scratch_; // for unescaping
+  intern_table *intern_;
+  size_t intern_max_length_;
+
+public:
+  borrowed_document() : root_(), arena_(), item_stack_(), member_stack_(), scratch_(), intern_(NULL), intern_max_length_(0) {
+  }
+  // From the next parse, keys and strings of up to max_length characters are taken from the table (and refer to it rather
+  // than to the input or the document).  The table must outlive the document.
+  void set_intern_table(intern_table *table, size_t max_length = 32) {
+    intern_ = table;
+    intern_max_length_ = max_length;
+  }
+  const borrowed_value &root() const {
+    return root_;
+  }
+  // releases the tree at once, keeping the buffers for the next parse
+  void clear() {
+    root_ = borrowed_value();
+    arena_.clear();
+    item_stack_.clear();
+    member_stack_.clear();
+  }
+  const arena &get_arena() const {
+    return arena_;
+  }
+
+private:
+  borrowed_document(const borrowed_document &);
+  borrowed_document &operator=(const borrowed_document &);
+};
+
+// builds a borrowed_document; strings are referenced in place only when parsing from contiguous input
+class borrowed_parse_context {
+protected:
+  borrowed_document *doc_;
+  borrowed_value *out_;
+  int container_;
+  size_t mark_; // where this container's children start on the document's stack
+
+public:
+  borrowed_parse_context(borrowed_document *doc, borrowed_value *out) : doc_(doc), out_(out), container_(null_type), mark_(0) {
+  }
+  bool set_null() {
+    *out_ = borrowed_value();
+    return true;
+  }
+  bool set_bool(bool b) {
+    *out_ = borrowed_value(b);
+    return true;
+  }
+#ifdef PICORISON_USE_INT64
+  bool set_int64(int64_t i) {
+    *out_ = borrowed_value(i);
+    return true;
+  }
+#endif
+  bool set_number(double f) {
+    *out_ = borrowed_value(f);
+    return true;
+  }
+  bool set_string(const std::string &s) {
+    *out_ = borrowed_value(own(s));
+    return true;
+  }
+  template <typename Iter> bool parse_string(input<Iter> &in) {
+    string_ref s;
+    if (!parse_quoted(in, s)) {
+      return false;
+    }
+    *out_ = borrowed_value(s);
+    return true;
+  }
+  bool parse_array_start() {
+    container_ = array_type;
+    mark_ = doc_->item_stack_.size();
+    return true;
+  }
+  template <typename Iter> bool parse_array_item(input<Iter> &in, size_t) {
+    borrowed_value item;
+    if (!parse_child(in, &item)) {
+      return false;
+    }
+    doc_->item_stack_.push_back(item);
+    return true;
+  }
+  bool parse_array_stop(size_t) {
+    return true;
+  }
+  bool parse_object_start() {
+    container_ = object_type;
+    mark_ = doc_->member_stack_.size();
+    return true;
+  }
+  template <typename Iter> bool parse_object_item(input<Iter> &in, const std::string &key) {
+    return parse_member(in, own(key));
+  }
+  // moves the children of the container just parsed off the stack into the document
+  void finish() {
+    if (container_ == array_type) {
+      *out_ = borrowed_value(borrowed_value::array(pop(doc_->item_stack_), doc_->item_stack_.size() - mark_));
+      doc_->item_stack_.resize(mark_);
+    } else if (container_ == object_type) {
+      *out_ = borrowed_value(borrowed_value::object(pop(doc_->member_stack_), doc_->member_stack_.size() - mark_));
+      doc_->member_stack_.resize(mark_);
+    }
+  }
+  // called through _parse_object_item and _parse_id_value on contiguous input
+  template <typename Ch> bool parse_object_item(input<Ch *> &in) {
+    string_ref key;
+    if (in.expect('\'')) {
+      if (!parse_quoted(in, key)) {
+        return false;
+      }
+    } else if (!parse_id(in, key)) {
+      return false;
+    } else {
+      key = atom(key);
+    }
+    if (!in.expect(':')) {
+      return in.fail("':'");
+    }
+    return parse_member(in, key);
+  }
+  template <typename Ch> bool parse_id_value(input<Ch *> &in) {
+    string_ref id;
+    if (!parse_id(in, id)) {
+      return false;
+    }
+    *out_ = borrowed_value(atom(id));
+    return true;
+  }
+
+protected:
+  // copies a string that does not come from the input into the document (or the intern table)
+  string_ref own(const std::string &s) {
+    return is_atom(s) ? doc_->intern_->intern(s) : doc_->arena_.copy(s);
+  }
+  bool is_atom(const string_ref &s) const {
+    return doc_->intern_ != NULL && s.size() <= doc_->intern_max_length_;
+  }
+  string_ref atom(const string_ref &s) {
+    return is_atom(s) ? doc_->intern_->intern(s) : s;
+  }
+  template <typename T> const T *pop(const std::vector<T> &stack) {
+    T *items = doc_->arena_.allocate_array<T>(stack.size() - mark_);
+    std::uninitialized_copy(stack.begin() + mark_, stack.end(), items);
+    return items;
+  }
+  template <typename Iter> bool unescape(input<Iter> &in, string_ref &out) {
+    doc_->scratch_.clear();
+    if (!_parse_string(doc_->scratch_, in)) {
+      return false;
+    }
+    out = own(doc_->scratch_);
+    return true;
+  }
+  template <typename Iter> bool parse_child(input<Iter> &in, borrowed_value *out) {
+    borrowed_parse_context ctx(doc_, out);
+    if (!_parse(ctx, in)) {
+      return false;
+    }
+    ctx.finish();
+    return true;
+  }
+  template <typename Iter> bool parse_member(input<Iter> &in, const string_ref &key) {
+    borrowed_value item;
+    if (!parse_child(in, &item)) {
+      return false;
+    }
+    doc_->member_stack_.push_back(borrowed_value::member(key, item));
+    return true;
+  }
+  // reads the rest of a quoted string, interning it if it is short; an unescaped copy is interned by own()
+  template <typename Iter> bool parse_quoted(input<Iter> &in, string_ref &out) {
+    return unescape(in, out);
+  }
+  template <typename Ch> bool parse_quoted(input<Ch *> &in, string_ref &out) {
+    Ch *first = in.cur(), *special = _find_string_special(first, in.end());
+    if (special != in.end() && *special == '\'') {
+      out = atom(string_ref(first, special - first));
+      in.seek(special + 1);
+      return true;
+    }
+    return unescape(in, out);
+  }
+  template <typename Ch> bool parse_id(input<Ch *> &in, string_ref &out) {
+    Ch *first = in.cur();
+    null_parse_context::dummy_str dummy;
+    if (!_parse_id(dummy, in)) {
+      return false;
+    }
+    out = string_ref(first, in.cur() - first);
+    return true;
+  }
+
+private:
+  borrowed_parse_context(const borrowed_parse_context &);
+  borrowed_parse_context &operator=(const borrowed_parse_context &);
+};
+
+template <typename Ch> inline bool _parse_object_item(borrowed_parse_context &ctx, input<Ch *> &in) {
+  return ctx.parse_object_item(in);
+}
+
+template <typename Ch> inline bool _parse_id_value(borrowed_parse_context &ctx, input<Ch *> &in) {
+  return ctx.parse_id_value(in);
+}
+
+inline const char *parse(borrowed_document &doc, const char *first, const char *last, std::string *err) {
+  doc.clear();
+  borrowed_parse_context ctx(&doc, &doc.root_);
+  input<const char *> in(first, last);
+  if (!_parse(ctx, in)) {
+    if (err != NULL) {
+      _set_error(in, err);
+    }
+    return in.cur();
+  }
+  ctx.finish();
+  return in.cur();
+}
+
+inline int _first_bit64(uint64_t mask) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long idx;
+  _BitScanForward64(&idx, mask);
+  return static_cast<int>(idx);
+#elif defined(_MSC_VER)
+  int idx = 0;
+  for (; (mask & 1) == 0; mask >>= 1) {
+    ++idx;
+  }
+  return idx;
+#else
+  return __builtin_ctzll(mask);
+#endif
+}
+
+// stage one of tape_document: finds the structural characters of a 64-byte block
+struct _structural_scanner {
+  uint64_t escape_carry_; // the previous block ended with an odd run of '!'
+  uint64_t in_string_;    // all ones if the previous block ended inside a string
+
+  _structural_scanner() : escape_carry_(0), in_string_(0) {
+  }
+  static void classify(const char *block, uint64_t &quote, uint64_t &bang, uint64_t &open, uint64_t &close, uint64_t &sep) {
+    quote = bang = open = close = sep = 0;
+#ifdef PICORISON_SSE2
+    const __m128i q = _mm_set1_epi8('\''), b = _mm_set1_epi8('!'), o = _mm_set1_epi8('('), c = _mm_set1_epi8(')'),
+                  comma = _mm_set1_epi8(','), colon = _mm_set1_epi8(':');
+    for (int i = 0; i < 4; ++i) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16));
+      quote |= _movemask64(_mm_cmpeq_epi8(x, q), i);
+      bang |= _movemask64(_mm_cmpeq_epi8(x, b), i);
+      open |= _movemask64(_mm_cmpeq_epi8(x, o), i);
+      close |= _movemask64(_mm_cmpeq_epi8(x, c), i);
+      sep |= _movemask64(_mm_or_si128(_mm_cmpeq_epi8(x, comma), _mm_cmpeq_epi8(x, colon)), i);
+    }
+#else
+    for (int i = 0; i < 64; ++i) {
+      uint64_t bit = uint64_t(1) << i;
+      switch (block[i]) {
+      case '\'':
+        quote |= bit;
+        break;
+      case '!':
+        bang |= bit;
+        break;
+      case '(':
+        open |= bit;
+        break;
+      case ')':
+        close |= bit;
+        break;
+      case ',':
+      case ':':
+        sep |= bit;
+        break;
+      default:
+        break;
+      }
+    }
+#endif
+  }
+  // the control characters of a block, which are not valid anywhere in RISON
+  static uint64_t controls(const char *block) {
+    uint64_t ctrl = 0;
+#ifdef PICORISON_SSE2
+    const __m128i c = _mm_set1_epi8(0x1f);
+    for (int i = 0; i < 4; ++i) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16));
+      ctrl |= _movemask64(_mm_cmpeq_epi8(_mm_min_epu8(x, c), x), i);
+    }
+#else
+    for (int i = 0; i < 64; ++i) {
+      if (static_cast<unsigned char>(block[i]) < ' ') {
+        ctrl |= uint64_t(1) << i;
+      }
+    }
+#endif
+    return ctrl;
+  }
+#ifdef PICORISON_SSE2
+  static uint64_t _movemask64(__m128i x, int i) {
+    return static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(x))) << (i * 16);
+  }
+#endif
+  // characters following an odd run of '!' are escaped, inside strings as well as in !t, !( and friends
+  uint64_t escaped(uint64_t bang) {
+    uint64_t escaped = escape_carry_;
+    bang &= ~escape_carry_;
+    escape_carry_ = 0;
+    while (bang != 0) {
+      int start = _first_bit64(bang);
+      uint64_t rest = ~(bang >> start);
+      int len = rest == 0 ? 64 - start : _first_bit64(rest);
+      if (start + len >= 64) {
+        escape_carry_ = len & 1;
+        break;
+      }
+      if (len & 1) {
+        escaped |= uint64_t(1) << (start + len);
+      }
+      bang &= ~(((uint64_t(1) << len) - 1) << start);
+    }
+    return escaped;
+  }
+  // marks everything from an opening quote up to (but excluding) the closing quote; unescapes quote in place
+  uint64_t strings(uint64_t &quote, uint64_t bang) {
+    quote &= ~escaped(bang);
+    uint64_t in_string = quote;
+    for (int shift = 1; shift < 64; shift *= 2) {
+      in_string ^= in_string << shift;
+    }
+    in_string ^= in_string_;
+    in_string_ = static_cast<uint64_t>(-static_cast<int64_t>(in_string >> 63));
+    return in_string;
+  }
+  uint64_t next(const char *block) {
+    uint64_t quote, bang, open, close, sep;
+    classify(block, quote, bang, open, close, sep);
+    uint64_t in_string = strings(quote, bang);
+    return ((open | close | sep) & ~in_string) | quote;
+  }
+  void containers(const char *block, uint64_t &open, uint64_t &close) {
+    uint64_t quote, bang, sep;
+    classify(block, quote, bang, open, close, sep);
+    uint64_t in_string = strings(quote, bang);
+    open &= ~in_string;
+    close &= ~in_string;
+  }
+};
+
+inline void _find_structurals(const char *buf, size_t len, std::vector<uint32_t> &out) {
+  _structural_scanner scanner;
+  out.clear();
+  for (size_t base = 0; base < len; base += 64) {
+    uint64_t bits;
+    if (len - base >= 64) {
+      bits = scanner.next(buf + base);
+    } else {
+      char block[64];
+      std::memset(block, ' ', sizeof(block));
+      std::memcpy(block, buf + base, len - base);
+      bits = scanner.next(block);
+    }
+    for (; bits != 0; bits &= bits - 1) {
+      out.push_back(static_cast<uint32_t>(base + _first_bit64(bits)));
+    }
+  }
+}
+
+inline int _count_bits64(uint64_t mask) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  return static_cast<int>(__popcnt64(mask));
+#elif defined(_MSC_VER)
+  int n = 0;
+  for (; mask != 0; mask &= mask - 1) {
+    ++n;
+  }
+  return n;
+#else
+  return __builtin_popcountll(mask);
+#endif
+}
+
+// returns the end of the array or object starting at p (at its '(' or '!('), or NULL if it is not closed before the end
+// of the input or a control character
+template <typename Ch> inline Ch *_skip_container(Ch *p, Ch *end) {
+  _structural_scanner scanner;
+  size_t depth = 0;
+  for (Ch *base = p; base < end; base += 64) {
+    const char *block = reinterpret_cast<const char *>(base);
+    char tail[64];
+    if (end - base < 64) {
+      std::memset(tail, ' ', sizeof(tail));
+      std::memcpy(tail, base, end - base);
+      block = tail;
+    }
+    uint64_t open, close;
+    scanner.containers(block, open, close);
+    uint64_t ctrl = _structural_scanner::controls(block);
+    if (ctrl != 0) {
+      // only the parentheses before the first control character count
+      uint64_t before = (uint64_t(1) << _first_bit64(ctrl)) - 1;
+      open &= before;
+      close &= before;
+    }
+    size_t closes = static_cast<size_t>(_count_bits64(close));
+    if (closes < depth) {
+      // the depth cannot reach zero within this block
+      if (ctrl != 0) {
+        return NULL;
+      }
+      depth += _count_bits64(open) - closes;
+      continue;
+    }
+    for (uint64_t bits = open | close; bits != 0; bits &= bits - 1) {
+      int i = _first_bit64(bits);
+      if (open >> i & 1) {
+        ++depth;
+      } else if (--depth == 0) {
+        return base + i + 1;
+      }
+    }
+    if (ctrl != 0) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+// returns the end of the quoted string starting at p, or NULL if it is not closed before the end of the input or a
+// control character
+template <typename Ch> inline Ch *_skip_quoted(Ch *p, Ch *end) {
+  for (++p; (p = _find_string_special(p, end)) != end; ++p) {
+    if (*p == '\'') {
+      return p + 1;
+    } else if (*p != '!' || ++p == end || (*p & 0xff) < ' ') {
+      break;
+    }
+  }
+  return NULL;
+}
+
+inline bool _is_skip_delimiter(int ch) {
+  return ch == -1 || ch == ',' || ch == ':' || ch == '(' || ch == ')' || ch == '\'' || ch == '!' ||
+         (char_class(ch) & control_char_class) != 0;
+}
+
+// returns the end of the value starting at p, or NULL if the input or a control character ends the value
+template <typename Ch> inline Ch *_skip_value(Ch *p, Ch *end) {
+  if (p == end) {
+    return p;
+  }
+  switch (*p) {
+  case '\'':
+    return _skip_quoted(p, end);
+  case '(':
+    return _skip_container(p, end);
+  case '!':
+    if (end - p < 2 || (p[1] & 0xff) < ' ') {
+      return NULL;
+    }
+    return p[1] == '(' ? _skip_container(p, end) : p + 2;
+  default:
+    for (; p != end && !_is_skip_delimiter(*p & 0xff); ++p)
+      ;
+    return p;
+  }
+}
+
+// Skips the value at the current position, leaving the input at the character that follows it.  Strings, arrays and
+// objects are skipped by tracking quotes (and their escapes) and parentheses only; their contents are not validated,
+// except that control characters are rejected as they are by the parser.  Contiguous input is scanned by _skip_value
+// (64 bytes at a time in containers), other input one character at a time below; both accept and reject the same values.
+template <typename Iter> inline bool _skip_quoted(input<Iter> &in) {
+  while (1) {
+    int ch = in.getc();
+    if (ch == '\'') {
+      return true;
+    } else if (ch == '!') {
+      ch = in.getc();
+    }
+    if (ch < ' ') {
+      in.ungetc();
+      return false;
+    }
+  }
+}
+
+template <typename Iter> inline bool skip(input<Iter> &in) {
+  int ch = in.getc();
+  if (ch == '\'') {
+    return _skip_quoted(in);
+  } else if (ch == '!' && (ch = in.getc()) != '(') {
+    if (ch < ' ') {
+      in.ungetc();
+      return false;
+    }
+    return true;
+  } else if (ch != '(') {
+    while (!_is_skip_delimiter(ch)) {
+      ch = in.getc();
+    }
+    in.ungetc();
+    return true;
+  }
+  for (size_t depth = 1; depth != 0;) {
+    bool escaped = (ch = in.getc()) == '!';
+    if (escaped) {
+      ch = in.getc();
+    }
+    if (ch < ' ') {
+      in.ungetc();
+      return false;
+    } else if (escaped) {
+      depth += ch == '(';
+      continue;
+    }
+    switch (ch) {
+    case '\'':
+      if (!_skip_quoted(in)) {
+        return false;
+      }
+      break;
+    case '(':
+      ++depth;
+      break;
+    case ')':
+      --depth;
+      break;
+    }
+  }
+  return true;
+}
+
+template <typename Ch> inline bool skip(input<Ch *> &in) {
+  Ch *p = _skip_value(in.cur(), in.end());
+  if (p == NULL) {
+    in.seek(in.end());
+    return false;
+  }
+  in.seek(p);
+  return true;
+}
+
+struct _number_capture {
+  int type_;
+  double number_;
+#ifdef PICORISON_USE_INT64
+  int64_t int64_;
+  bool set_int64(int64_t i) {
+    type_ = int64_type;
+    int64_ = i;
+    return true;
+  }
+#endif
+  bool set_number(double f) {
+    type_ = number_type;
+    number_ = f;
+    return true;
+  }
+};
+
+class tape_element;
+
+// a read-only document parsed in two passes: a vectorized scan indexes the structural characters, then a
+// non-recursive pass writes a flat tape of 64-bit entries (type in the top byte) and a buffer of unescaped strings
+class tape_document {
+  friend class tape_element;
+
+public:
+  enum {
+    tape_null = 'n',
+    tape_true = 't',
+    tape_false = 'f',
+    tape_number = 'd', // followed by the bits of a double
+    tape_int64 = 'l',  // followed by the bits of an int64_t
+    tape_string = 's', // payload is the offset of a length-prefixed string
+    tape_array_start = '[',
+    tape_array_end = ']',
+    tape_object_start = '{', // members are stored as a key string followed by the value
+    tape_object_end = '}'
+  };
+
+protected:
+  std::vector<uint64_t> tape_;
+  std::vector<char> strings_;
+  std::vector<uint32_t> structurals_; // scratch, kept for reuse
+  std::vector<uint32_t> open_;        // scratch: tape indices of the open containers
+
+public:
+  tape_document() : tape_(), strings_(), structurals_(), open_() {
+  }
+  // returns an empty string on success, or the error message
+  std::string parse(const char *first, const char *last);
+  std::string parse(const std::string &s) {
+    return parse(s.data(), s.data() + s.size());
+  }
+  tape_element root() const;
+
+protected:
+  static uint64_t make(int type, uint64_t payload = 0) {
+    return static_cast<uint64_t>(type) << 56 | payload;
+  }
+  void append_scalar_bits(int type, const void *bits) {
+    uint64_t word;
+    std::memcpy(&word, bits, sizeof(word));
+    tape_.push_back(make(type));
+    tape_.push_back(word);
+  }
+  bool append_string(const char *first, const char *last);
+  bool append_scalar(const char *first, const char *last);
+  bool append_id(const char *first, const char *last) {
+    if (first != last && (char_class(*first) & id_start_reject_class)) {
+      return false;
+    }
+    for (const char *p = first; p != last; ++p) {
+      if (!(char_class(*p) & id_char_class)) {
+        return false;
+      }
+    }
+    return append_raw_string(first, last - first);
+  }
+  bool append_raw_string(const char *data, size_t size) {
+    uint32_t len = static_cast<uint32_t>(size);
+    tape_.push_back(make(tape_string, strings_.size()));
+    strings_.insert(strings_.end(), reinterpret_cast<const char *>(&len), reinterpret_cast<const char *>(&len) + sizeof(len));
+    strings_.insert(strings_.end(), data, data + size);
+    return true;
+  }
+  void close(int type) {
+    uint32_t open = open_.back();
+    open_.pop_back();
+    uint64_t count = 0;
+    for (uint64_t i = open + 1, end = tape_.size(); i < end; ++count) {
+      i = skip(i);
+    }
+    if (type == tape_object_end) {
+      count /= 2;
+    }
+    count = std::min(count, (uint64_t(1) << 24) - 1);
+    tape_.push_back(make(type, open));
+    tape_[open] |= count << 32 | tape_.size();
+  }
+  size_t skip(size_t idx) const {
+    switch (tape_[idx] >> 56) {
+    case tape_array_start:
+    case tape_object_start:
+      return tape_[idx] & 0xffffffff;
+    case tape_number:
+    case tape_int64:
+      return idx + 2;
+    default:
+      return idx + 1;
+    }
+  }
+};
+
+// a position in a tape_document; cheap to copy, valid as long as the document is not reparsed
+class tape_element {
+public:
+  class array;
+  class object;
+
+protected:
+  const tape_document *doc_;
+  size_t idx_;
+
+public:
+  tape_element(const tape_document *doc, size_t idx) : doc_(doc), idx_(idx) {
+  }
+  template <typename T> bool is() const;
+  template <typename T> T get() const;
+  size_t size() const; // number of items or members of an array or an object
+  tape_element get(size_t idx) const;
+  tape_element get(const string_ref &key) const;
+  bool contains(size_t idx) const;
+  bool contains(const string_ref &key) const;
+  value to_value() const;
+
+protected:
+  int type() const {
+    return static_cast<int>(doc_->tape_[idx_] >> 56);
+  }
+  uint64_t payload() const {
+    return doc_->tape_[idx_] & ((uint64_t(1) << 56) - 1);
+  }
+  string_ref string_at(size_t offset) const {
+    uint32_t len;
+    std::memcpy(&len, &doc_->strings_[offset], sizeof(len));
+    return string_ref(doc_->strings_.data() + offset + sizeof(len), len);
+  }
+  tape_element next() const {
+    return tape_element(doc_, doc_->skip(idx_));
+  }
+  size_t end_index() const {
+    return (payload() & 0xffffffff) - 1;
+  }
+  bool find(const string_ref &key, tape_element &out) const;
+  static tape_element null_element() {
+    static tape_document empty;
+    static bool initialized = (empty.parse("!n", "!n" + 2), true);
+    (void)initialized;
+    return tape_element(&empty, 0);
+  }
+  friend class tape_document;
+};
+
+class tape_element::array {
+protected:
+  tape_element begin_, end_;
+
+public:
+  class const_iterator {
+    tape_element cur_;
+
+  public:
+    explicit const_iterator(const tape_element &cur) : cur_(cur) {
+    }
+    const tape_element &operator*() const {
+      return cur_;
+    }
+    const tape_element *operator->() const {
+      return &cur_;
+    }
+    const_iterator &operator++() {
+      cur_ = cur_.next();
+      return *this;
+    }
+    bool operator==(const const_iterator &x) const {
+      return cur_.idx_ == x.cur_.idx_;
+    }
+    bool operator!=(const const_iterator &x) const {
+      return !(*this == x);
+    }
+  };
+  array(const tape_element &begin, const tape_element &end) : begin_(begin), end_(end) {
+  }
+  const_iterator begin() const {
+    return const_iterator(begin_);
+  }
+  const_iterator end() const {
+    return const_iterator(end_);
+  }
+};
+
+class tape_element::object {
+protected:
+  tape_element begin_, end_;
+
+public:
+  class const_iterator {
+    tape_element key_;
+
+  public:
+    explicit const_iterator(const tape_element &key) : key_(key) {
+    }
+    string_ref key() const {
+      return key_.string_at(key_.payload());
+    }
+    tape_element value() const {
+      return tape_element(key_.doc_, key_.idx_ + 1);
+    }
+    const_iterator &operator++() {
+      key_ = value().next();
+      return *this;
+    }
+    bool operator==(const const_iterator &x) const {
+      return key_.idx_ == x.key_.idx_;
+    }
+    bool operator!=(const const_iterator &x) const {
+      return !(*this == x);
+    }
+  };
+  object(const tape_element &begin, const tape_element &end) : begin_(begin), end_(end) {
+  }
+  const_iterator begin() const {
+    return const_iterator(begin_);
+  }
+  const_iterator end() const {
+    return const_iterator(end_);
+  }
+};
+
+inline tape_element tape_document::root() const {
+  PICORISON_ASSERT(!tape_.empty());
+  return tape_element(this, 0);
+}
+
+inline bool tape_document::append_string(const char *first, const char *last) {
+  // first and last are the quotes; the closing one is known to be unescaped
+  const char *p = first + 1;
+  const char *special = _find_string_special(p, last);
+  if (special == last) {
+    return append_raw_string(p, last - p);
+  }
+  size_t start = tape_.size();
+  uint32_t len = 0;
+  size_t len_at = strings_.size();
+  tape_.push_back(make(tape_string, len_at));
+  strings_.insert(strings_.end(), sizeof(len), '\0');
+  while (1) {
+    strings_.insert(strings_.end(), p, special);
+    if (special == last) {
+      break;
+    }
+    if (*special != '!' || (special[1] != '!' && special[1] != '\'')) {
+      tape_.resize(start);
+      return false;
+    }
+    strings_.push_back(special[1]);
+    p = special + 2;
+    special = _find_string_special(p, last);
+  }
+  len = static_cast<uint32_t>(strings_.size() - len_at - sizeof(len));
+  std::memcpy(&strings_[len_at], &len, sizeof(len));
+  return true;
+}
+
+inline bool tape_document::append_scalar(const char *first, const char *last) {
+  if (first == last || !(('0' <= *first && *first <= '9') || *first == '-')) {
+    return append_id(first, last);
+  }
+  _number_capture num;
+  input<const char *> in(first, last);
+  if (!_parse_number(num, in) || in.cur() != last) {
+    return false;
+  }
+#ifdef PICORISON_USE_INT64
+  if (num.type_ == int64_type) {
+    append_scalar_bits(tape_int64, &num.int64_);
+    return true;
+  }
+#endif
+  if (
+#ifdef _MSC_VER
+      !_finite(num.number_)
+#else
+      std::isnan(num.number_) || std::isinf(num.number_)
+#endif
+  ) {
+    return false;
+  }
+  append_scalar_bits(tape_number, &num.number_);
+  return true;
+}
+
+inline std::string tape_document::parse(const char *first, const char *last) {
+  tape_.clear();
+  strings_.clear();
+  open_.clear();
+  const size_t len = last - first;
+  if (len >= 0xffffffff) {
+    return "input too large";
+  }
+  _find_structurals(first, len, structurals_);
+  const uint32_t *s = structurals_.data(), *s_end = s + structurals_.size();
+  size_t p = 0;
+  enum { expect_value, expect_key, expect_separator } state = expect_value;
+
+  while (1) {
+    if (state == expect_value) {
+      int ch = p < len ? first[p] & 0xff : -1;
+      if (ch == '(' || (ch == '!' && p + 1 < len && first[p + 1] == '(')) {
+        if (ch == '!') {
+          ++p;
+        }
+        if (s == s_end || *s != p) {
+          break;
+        }
+        ++s;
+        open_.push_back(static_cast<uint32_t>(tape_.size()));
+        tape_.push_back(make(ch == '(' ? tape_object_start : tape_array_start));
+        ++p;
+        if (p < len && first[p] == ')') {
+          ++s;
+          ++p;
+          close(ch == '(' ? tape_object_end : tape_array_end);
+          state = expect_separator;
+        } else {
+          state = ch == '(' ? expect_key : expect_value;
+        }
+        continue;
+      } else if (ch == '!') {
+        int lit = p + 1 < len ? first[p + 1] : -1;
+        if (lit != 'n' && lit != 't' && lit != 'f') {
+          break;
+        }
+        tape_.push_back(make(lit));
+        p += 2;
+      } else if (ch == '\'') {
+        if (s == s_end || *s != p || s + 1 == s_end || !append_string(first + p, first + s[1])) {
+          break;
+        }
+        p = s[1] + 1;
+        s += 2;
+      } else {
+        if (ch != -1 && (char_class(ch) & control_char_class)) {
+          break;
+        }
+        size_t end = s != s_end ? *s : len;
+        if (!append_scalar(first + p, first + end)) {
+          break;
+        }
+        p = end;
+      }
+      state = expect_separator;
+    } else if (state == expect_key) {
+      if (p < len && first[p] == '\'') {
+        if (s == s_end || *s != p || s + 1 == s_end || !append_string(first + p, first + s[1])) {
+          break;
+        }
+        p = s[1] + 1;
+        s += 2;
+      } else {
+        size_t end = s != s_end ? *s : len;
+        if (!append_id(first + p, first + end)) {
+          break;
+        }
+        p = end;
+      }
+      if (p >= len || first[p] != ':' || s == s_end || *s != p) {
+        break;
+      }
+      ++s;
+      ++p;
+      state = expect_value;
+    } else {
+      if (open_.empty()) {
+        if (p == len) {
+          return std::string();
+        }
+        break;
+      }
+      bool in_object = tape_[open_.back()] >> 56 == tape_object_start;
+      if (p >= len || s == s_end || *s != p) {
+        break;
+      }
+      ++s;
+      if (first[p] == ',') {
+        state = in_object ? expect_key : expect_value;
+      } else if (first[p] == ')') {
+        close(in_object ? tape_object_end : tape_array_end);
+      } else {
+        break;
+      }
+      ++p;
+    }
+  }
+  tape_.clear();
+  input<const char *> in(first, last);
+  in.seek(first + std::min(p, len));
+  std::string err;
+  _set_error(in, &err);
+  return err;
+}
+
+#define IS(ctype, ttype)                                                                                                           \
+  template <> inline bool tape_element::is<ctype>() const {                                                                        \
+    return ttype;                                                                                                                  \
+  }
+IS(null, type() == tape_document::tape_null)
+IS(bool, type() == tape_document::tape_true || type() == tape_document::tape_false)
+IS(double, type() == tape_document::tape_number || type() == tape_document::tape_int64)
+#ifdef PICORISON_USE_INT64
+IS(int64_t, type() == tape_document::tape_int64)
+#endif
+IS(string_ref, type() == tape_document::tape_string)
+IS(tape_element::array, type() == tape_document::tape_array_start)
+IS(tape_element::object, type() == tape_document::tape_object_start)
+#undef IS
+
+#define GET(ctype, var)                                                                                                            \
+  template <> inline ctype tape_element::get<ctype>() const {                                                                      \
+    PICORISON_ASSERT("type mismatch! call is<type>() before get<type>()" && is<ctype>());                                           \
+    return var;                                                                                                                    \
+  }
+GET(bool, type() == tape_document::tape_true)
+GET(string_ref, string_at(payload()))
+GET(tape_element::array, array(tape_element(doc_, idx_ + 1), tape_element(doc_, end_index())))
+GET(tape_element::object, object(tape_element(doc_, idx_ + 1), tape_element(doc_, end_index())))
+#undef GET
+
+template <> inline double tape_element::get<double>() const {
+  PICORISON_ASSERT("type mismatch! call is<type>() before get<type>()" && is<double>());
+  uint64_t bits = doc_->tape_[idx_ + 1];
+  if (type() == tape_document::tape_int64) {
+    int64_t i;
+    std::memcpy(&i, &bits, sizeof(i));
+    return static_cast<double>(i);
+  }
+  double f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+#ifdef PICORISON_USE_INT64
+template <> inline int64_t tape_element::get<int64_t>() const {
+  PICORISON_ASSERT("type mismatch! call is<type>() before get<type>()" && is<int64_t>());
+  int64_t i;
+  std::memcpy(&i, &doc_->tape_[idx_ + 1], sizeof(i));
+  return i;
+}
+#endif
+
+inline size_t tape_element::size() const {
+  PICORISON_ASSERT(is<array>() || is<object>());
+  size_t count = static_cast<size_t>(payload() >> 32);
+  if (count == (size_t(1) << 24) - 1) {
+    // saturated; count by walking
+    count = 0;
+    for (size_t i = idx_ + 1, end = end_index(); i < end; i = doc_->skip(i)) {
+      ++count;
+    }
+    if (is<object>()) {
+      count /= 2;
+    }
+  }
+  return count;
+}
+
+inline tape_element tape_element::get(size_t idx) const {
+  array a = get<array>();
+  for (array::const_iterator i = a.begin(); i != a.end(); ++i, --idx) {
+    if (idx == 0) {
+      return *i;
+    }
+  }
+  return null_element();
+}
+
+inline bool tape_element::find(const string_ref &key, tape_element &out) const {
+  // the last occurrence wins, as it does when parsing into value
+  bool found = false;
+  object o = get<object>();
+  for (object::const_iterator i = o.begin(); i != o.end(); ++i) {
+    if (i.key() == key) {
+      out = i.value();
+      found = true;
+    }
+  }
+  return found;
+}
+
+inline tape_element tape_element::get(const string_ref &key) const {
+  tape_element out = null_element();
+  find(key, out);
+  return out;
+}
+
+inline bool tape_element::contains(size_t idx) const {
+  return idx < size();
+}
+
+inline bool tape_element::contains(const string_ref &key) const {
+  tape_element out = *this;
+  return find(key, out);
+}
+
+inline value tape_element::to_value() const {
+  switch (type()) {
+  case tape_document::tape_true:
+  case tape_document::tape_false:
+    return value(get<bool>());
+  case tape_document::tape_number:
+    return value(get<double>());
+#ifdef PICORISON_USE_INT64
+  case tape_document::tape_int64:
+    return value(get<int64_t>());
+#endif
+  case tape_document::tape_string: {
+    string_ref s = get<string_ref>();
+    return value(s.data(), s.size());
+  }
+  case tape_document::tape_array_start: {
+    value v(array_type, false);
+    picorison::array &a = v.get<picorison::array>();
+    array items = get<array>();
+    for (array::const_iterator i = items.begin(); i != items.end(); ++i) {
+      a.push_back(i->to_value());
+    }
+    return v;
+  }
+  case tape_document::tape_object_start: {
+    value v(object_type, false);
+    picorison::object &o = v.get<picorison::object>();
+    object members = get<object>();
+    for (object::const_iterator i = members.begin(); i != members.end(); ++i) {
+      o[i.key().str()] = i.value().to_value();
+    }
+    return v;
+  }
+  default:
+    return value();
+  }
+}
+
+// a cursor over unparsed input; navigating skips the bytes of sibling values, and only the values that are read are decoded.
+// The input must outlive the cursor.  Malformed input is reported (through PICORISON_ASSERT) only when it is reached.
+class lazy_value {
+protected:
+  const char *cur_; // first byte of the value
+  const char *end_; // end of the input
+
+public:
+  lazy_value() : cur_("!n"), end_(cur_ + 2) {
+  }
+  lazy_value(const char *first, const char *last) : cur_(first), end_(last) {
+  }
+  explicit lazy_value(const std::string &s) : cur_(s.data()), end_(s.data() + s.size()) {
+  }
+  // the string must outlive the lazy_value
+  lazy_value(const std::string &&) = delete;
+  template <typename T> bool is() const;
+  template <typename T> T get() const;
+  lazy_value get(size_t idx) const;
+  lazy_value get(const string_ref &key) const; // the first occurrence of a duplicated key is returned
+  lazy_value operator[](size_t idx) const {
+    return get(idx);
+  }
+  lazy_value operator[](const string_ref &key) const {
+    return get(key);
+  }
+  bool contains(size_t idx) const;
+  bool contains(const string_ref &key) const;
+  string_ref raw() const; // the bytes of the value
+  value to_value() const;
+
+protected:
+  int peek(size_t off = 0) const {
+    return cur_ + off < end_ ? cur_[off] & 0xff : -1;
+  }
+  const char *skip(const char *p) const {
+    p = _skip_value(p, end_);
+    PICORISON_ASSERT("unterminated value" && p != NULL);
+    return p;
+  }
+  bool find(size_t idx, const char *&found) const;
+  bool find(const string_ref &key, const char *&found) const;
+  value decode() const {
+    value v;
+    std::string err;
+    parse(v, cur_, end_, &err);
+    PICORISON_ASSERT("malformed value" && err.empty());
+    return v;
+  }
+};
+
+template <> inline bool lazy_value::is<null>() const {
+  return peek() == '!' && peek(1) == 'n';
+}
+template <> inline bool lazy_value::is<bool>() const {
+  return peek() == '!' && (peek(1) == 't' || peek(1) == 'f');
+}
+template <> inline bool lazy_value::is<double>() const {
+  return peek() == '-' || ('0' <= peek() && peek() <= '9');
+}
+template <> inline bool lazy_value::is<std::string>() const {
+  return peek() == '\'' || (peek() != '!' && peek() != '(' && !is<double>());
+}
+template <> inline bool lazy_value::is<array>() const {
+  return peek() == '!' && peek(1) == '(';
+}
+template <> inline bool lazy_value::is<object>() const {
+  return peek() == '(';
+}
+#ifdef PICORISON_USE_INT64
+template <> inline bool lazy_value::is<int64_t>() const {
+  return is<double>() && decode().is<int64_t>();
+}
+#endif
+
+#define GET(ctype)                                                                                                                 \
+  template <> inline ctype lazy_value::get<ctype>() const {                                                                        \
+    PICORISON_ASSERT("type mismatch! call is<type>() before get<type>()" && is<ctype>());                                           \
+    return decode().get<ctype>();                                                                                                  \
+  }
+GET(bool)
+GET(double)
+GET(std::string)
+#ifdef PICORISON_USE_INT64
+GET(int64_t)
+#endif
+#undef GET
+
+inline bool lazy_value::find(size_t idx, const char *&found) const {
+  PICORISON_ASSERT("type mismatch! call is<type>() before get<type>()" && is<array>());
+  const char *p = cur_ + 2;
+  if (p != end_ && *p == ')') {
+    return false;
+  }
+  while (1) {
+    if (idx-- == 0) {
+      found = p;
+      return true;
+    }
+    p = skip(p);
+    PICORISON_ASSERT("syntax error" && p != end_ && (*p == ',' || *p == ')'));
+    if (*p++ == ')') {
+      return false;
+    }
+  }
+}
+
+inline bool lazy_value::find(const string_ref &key, const char *&found) const {
+  PICORISON_ASSERT("type mismatch! call is<type>() before get<type>()" && is<object>());
+  const char *p = cur_ + 1;
+  if (p != end_ && *p == ')') {
+    return false;
+  }
+  std::string unescaped;
+  while (1) {
+    bool match;
+    if (p != end_ && *p == '\'') {
+      const char *q = _find_string_special(p + 1, end_);
+      if (q != end_ && *q == '\'') {
+        match = key == string_ref(p + 1, q - p - 1);
+        p = q + 1;
+      } else {
+        // the key has escapes
+        input<const char *> in(p + 1, end_);
+        unescaped.clear();
+        bool ok = _parse_string(unescaped, in);
+        PICORISON_ASSERT("syntax error" && ok);
+        (void)ok;
+        match = key == unescaped;
+        p = in.cur();
+      }
+    } else {
+      const char *q = _find_id_end(p, end_);
+      match = key == string_ref(p, q - p);
+      p = q;
+    }
+    PICORISON_ASSERT("syntax error" && p != end_ && *p == ':');
+    ++p;
+    if (match) {
+      found = p;
+      return true;
+    }
+    p = skip(p);
+    PICORISON_ASSERT("syntax error" && p != end_ && (*p == ',' || *p == ')'));
+    if (*p++ == ')') {
+      return false;
+    }
+  }
+}
+
+inline lazy_value lazy_value::get(size_t idx) const {
+  const char *found;
+  return find(idx, found) ? lazy_value(found, end_) : lazy_value();
+}
+
+inline lazy_value lazy_value::get(const string_ref &key) const {
+  const char *found;
+  return find(key, found) ? lazy_value(found, end_) : lazy_value();
+}
+
+inline bool lazy_value::contains(size_t idx) const {
+  const char *found;
+  return find(idx, found);
+}
+
+inline bool lazy_value::contains(const string_ref &key) const {
+  const char *found;
+  return find(key, found);
+}
+
+inline string_ref lazy_value::raw() const {
+  return string_ref(cur_, skip(cur_) - cur_);
+}
+
+inline value lazy_value::to_value() const {
+  return decode();
+}
+
+// Parses a value from contiguous input without recursion, reporting it to an event handler (see value_handler).
+// Strings and keys without escapes are passed as references into the input; escaped ones are unescaped into a scratch
+// buffer, which is kept (as is the stack) to be reused by the next parse.
+class event_parser {
+protected:
+  struct frame {
+    bool object;
+    size_t count;
+  };
+  std::vector<frame> stack_;
+  std::string scratch_;
+
+public:
+  event_parser() : stack_(), scratch_() {
+  }
+  // returns the position after the value, like parse()
+  template <typename Handler> const char *parse(Handler &handler, const char *first, const char *last, std::string *err = NULL) {
+    input<const char *> in(first, last);
+    stack_.clear();
+    if (!run(handler, in) && err != NULL) {
+      _set_error(in, err);
+    }
+    return in.cur();
+  }
+  template <typename Handler> std::string parse(Handler &handler, const std::string &s) {
+    std::string err;
+    parse(handler, s.data(), s.data() + s.size(), &err);
+    return err;
+  }
+
+protected:
+  template <typename Handler> bool run(Handler &handler, input<const char *> &in) {
+    while (1) {
+      // a value
+      int ch = in.getc();
+      switch (ch) {
+      case '!':
+        switch (ch = in.getc()) {
+        case 'n':
+          if (!handler.on_null()) {
+            return false;
+          }
+          break;
+        case 't':
+        case 'f':
+          if (!handler.on_bool(ch == 't')) {
+            return false;
+          }
+          break;
+        case '(':
+          if (!handler.on_start_array()) {
+            return false;
+          } else if (!in.expect(')')) {
+            frame f = {false, 0};
+            stack_.push_back(f);
+            continue;
+          } else if (!handler.on_end_array(0)) {
+            return false;
+          }
+          break;
+        default:
+          return in.fail("'n', 't', 'f' or '(' after '!'");
+        }
+        break;
+      case '\'': {
+        string_ref s;
+        if (!parse_quoted(in, s) || !handler.on_string(s)) {
+          return false;
+        }
+        break;
+      }
+      case '(':
+        if (!handler.on_start_object()) {
+          return false;
+        } else if (!in.expect(')')) {
+          frame f = {true, 0};
+          stack_.push_back(f);
+          if (!parse_key(handler, in)) {
+            return false;
+          }
+          continue;
+        } else if (!handler.on_end_object(0)) {
+          return false;
+        }
+        break;
+      default:
+        if (('0' <= ch && ch <= '9') || ch == '-') {
+          in.ungetc();
+          _number_capture num;
+          if (!_parse_number(num, in)) {
+            return false;
+          }
+#ifdef PICORISON_USE_INT64
+          if (num.type_ == int64_type) {
+            if (!handler.on_int64(num.int64_)) {
+              return false;
+            }
+            break;
+          }
+#endif
+          if (!handler.on_number(num.number_)) {
+            return false;
+          }
+        } else if (ch != -1 && (char_class(ch) & control_char_class)) {
+          return in.fail("a value");
+        } else {
+          in.ungetc();
+          const char *id_end = _find_id_end(in.cur(), in.end());
+          string_ref id(in.cur(), id_end - in.cur());
+          in.seek(id_end);
+          if (!handler.on_string(id)) {
+            return false;
+          }
+        }
+        break;
+      }
+      // the value is complete; close the containers it completes
+      while (1) {
+        if (stack_.empty()) {
+          return true;
+        }
+        frame &f = stack_.back();
+        ++f.count;
+        if (in.expect(',')) {
+          if (f.object && !parse_key(handler, in)) {
+            return false;
+          }
+          break;
+        } else if (!in.expect(')')) {
+          return in.fail("',' or ')'");
+        }
+        frame closed = f;
+        stack_.pop_back();
+        if (!(closed.object ? handler.on_end_object(closed.count) : handler.on_end_array(closed.count))) {
+          return false;
+        }
+      }
+    }
+  }
+  bool parse_quoted(input<const char *> &in, string_ref &out) {
+    const char *p = in.cur(), *special = _find_string_special(p, in.end());
+    if (special != in.end() && *special == '\'') {
+      out = string_ref(p, special - p);
+      in.seek(special + 1);
+      return true;
+    }
+    scratch_.assign(p, special);
+    in.seek(special);
+    if (!_parse_string(scratch_, in)) {
+      return false;
+    }
+    out = scratch_;
+    return true;
+  }
+  template <typename Handler> bool parse_key(Handler &handler, input<const char *> &in) {
+    string_ref key;
+    if (in.expect('\'')) {
+      if (!parse_quoted(in, key)) {
+        return false;
+      }
+    } else {
+      int ch = in.peek();
+      if (ch != -1 && (char_class(ch) & id_start_reject_class)) {
+        return in.fail("a key");
+      }
+      const char *id_end = _find_id_end(in.cur(), in.end());
+      key = string_ref(in.cur(), id_end - in.cur());
+      in.seek(id_end);
+    }
+    if (!in.expect(':')) {
+      return in.fail("':'");
+    }
+    return handler.on_key(key);
+  }
+};
+
+// limits enforced by basic_push_parser; each defaults to unlimited
+struct parse_limits {
+  size_t max_depth;         // nesting of arrays and objects
+  size_t max_nodes;         // number of values, including arrays and objects
+  size_t max_string_length; // length of a string, id or key after unescaping, or of a number
+  size_t max_bytes;         // size of the input
+
+  parse_limits()
+      : max_depth(std::numeric_limits<size_t>::max()), max_nodes(std::numeric_limits<size_t>::max()),
+        max_string_length(std::numeric_limits<size_t>::max()), max_bytes(std::numeric_limits<size_t>::max()) {
+  }
+};
+
+// An incremental parser that accepts the input in chunks.  The state that a recursive parse keeps on the C++ stack is kept
+// in an explicit stack, and partial strings, ids and numbers are buffered between calls to feed().
+template <typename Handler> class basic_push_parser {
+public:
+  enum status { need_more, complete, failed };
+
+protected:
+  enum { st_value, st_first_value, st_key, st_first_key, st_colon, st_after, st_failed };
+  enum { lex_none, lex_string, lex_string_escape, lex_bang, lex_number, lex_id };
+  struct frame {
+    bool object;
+    size_t count;
+  };
+  Handler *handler_;
+  parse_limits limits_;
+  std::vector<frame> stack_;
+  int state_;
+  int lex_;
+  bool lex_key_; // the string or id being lexed is a key
+  std::string token_;
+  parse_error err_;
+  size_t nodes_;
+  size_t bytes_;        // fed so far
+  const char *chunk_;   // the chunk being parsed
+  size_t chunk_offset_; // of chunk_ in the input
+
+public:
+  basic_push_parser(Handler &handler, const parse_limits &limits = parse_limits())
+      : handler_(&handler), limits_(limits), stack_(), state_(st_value), lex_(lex_none), lex_key_(false), token_(), err_(),
+        nodes_(0), bytes_(0), chunk_(NULL), chunk_offset_(0) {
+  }
+  // parses the next chunk of the input; returns complete once a whole value has been read and no more input can belong to it
+  status feed(const char *p, size_t len);
+  // signals the end of the input, completing a trailing id or number
+  status finish();
+  const std::string &error() const {
+    return err_.message;
+  }
+  // where and why the parse failed, with the offset counted from the start of the whole input
+  const parse_error &error_info() const {
+    return err_;
+  }
+  // prepares for parsing another document (the handler has to be reset separately); the scratch buffers are kept
+  void reset() {
+    stack_.clear();
+    state_ = st_value;
+    lex_ = lex_none;
+    token_.clear();
+    err_ = parse_error();
+    nodes_ = 0;
+    bytes_ = 0;
+  }
+
+protected:
+  // fails at p in the current chunk; the message quotes the rest of the chunk
+  status fail(const char *p, const char *end, const char *what = "syntax error") {
+    input<const char *> in(p, end);
+    _set_error(in, &err_.message, what);
+    return fail_at(chunk_offset_ + (p - chunk_), "");
+  }
+  // fails once the whole input has been fed
+  status fail_at_end(size_t offset, const char *expected) {
+    input<const char *> in(NULL, NULL);
+    _set_error(in, &err_.message);
+    return fail_at(offset, expected);
+  }
+  status fail_at(size_t offset, const char *expected) {
+    // a newline is not valid anywhere in RISON, so the input before the error is a single line
+    err_.offset = offset;
+    err_.line = 1;
+    err_.column = static_cast<int>(offset) + 1;
+    err_.expected = expected;
+    state_ = st_failed;
+    return failed;
+  }
+  status current() const {
+    return state_ == st_failed ? failed : stack_.empty() && state_ == st_after && lex_ == lex_none ? complete : need_more;
+  }
+  void value_done() {
+    if (!stack_.empty()) {
+      ++stack_.back().count;
+    }
+    state_ = st_after;
+  }
+  bool end_token() {
+    lex_ = lex_none;
+    if (lex_key_) {
+      state_ = st_colon;
+      return handler_->on_key(token_);
+    }
+    value_done();
+    return handler_->on_string(token_);
+  }
+  bool end_number() {
+    lex_ = lex_none;
+    value_done();
+    _number_capture num;
+    input<const char *> in(token_.data(), token_.data() + token_.size());
+    if (!_parse_number(num, in) || in.cur() != token_.data() + token_.size()) {
+      return false;
+    }
+#ifdef PICORISON_USE_INT64
+    if (num.type_ == int64_type) {
+      return handler_->on_int64(num.int64_);
+    }
+#endif
+    return handler_->on_number(num.number_);
+  }
+  bool end_container() {
+    frame f = stack_.back();
+    stack_.pop_back();
+    value_done();
+    return f.object ? handler_->on_end_object(f.count) : handler_->on_end_array(f.count);
+  }
+  bool start_container(bool object) {
+    frame f = {object, 0};
+    stack_.push_back(f);
+    state_ = object ? st_first_key : st_first_value;
+    return object ? handler_->on_start_object() : handler_->on_start_array();
+  }
+};
+
+template <typename Handler> inline typename basic_push_parser<Handler>::status basic_push_parser<Handler>::feed(const char *p, size_t len) {
+  const char *end = p + len;
+  if (state_ == st_failed) {
+    return failed;
+  }
+  if (len > limits_.max_bytes - bytes_) {
+    // parse what fits, then fail at the first byte over the limit
+    const char *over = p + (limits_.max_bytes - bytes_);
+    if (feed(p, over - p) == failed) {
+      return failed;
+    }
+    return fail(over, end, "input size limit exceeded");
+  }
+  chunk_ = p;
+  chunk_offset_ = bytes_;
+  bytes_ += len;
+  const char *begin = p;
+  while (p != end) {
+    const char *at = p;
+    int ch = *p & 0xff;
+    bool ok = true;
+    switch (lex_) {
+    case lex_string: {
+      const char *special = _find_string_special(p, end);
+      token_.append(p, special);
+      p = special;
+      if (token_.size() > limits_.max_string_length) {
+        return fail(at, end, "string length limit exceeded");
+      } else if (p == end) {
+        continue;
+      } else if (*p == '\'') {
+        ++p;
+        ok = end_token();
+      } else if (*p == '!') {
+        ++p;
+        lex_ = lex_string_escape;
+      } else {
+        // a control character
+        return fail(p, end);
+      }
+      break;
+    }
+    case lex_string_escape:
+      if (ch != '!' && ch != '\'') {
+        ok = false;
+        break;
+      }
+      token_.push_back(static_cast<char>(ch));
+      ++p;
+      lex_ = lex_string;
+      break;
+    case lex_bang:
+      ++p;
+      lex_ = lex_none;
+      switch (ch) {
+      case 'n':
+        value_done();
+        ok = handler_->on_null();
+        break;
+      case 't':
+      case 'f':
+        value_done();
+        ok = handler_->on_bool(ch == 't');
+        break;
+      case '(':
+        if (stack_.size() >= limits_.max_depth) {
+          return fail(at != begin ? at - 1 : at, end, "depth limit exceeded");
+        }
+        ok = start_container(false);
+        break;
+      default:
+        ok = false;
+        break;
+      }
+      break;
+    case lex_number:
+      for (; p != end && _is_number_char(*p & 0xff); ++p) {
+        token_.push_back(*p);
+      }
+      if (token_.size() > limits_.max_string_length) {
+        return fail(at, end, "string length limit exceeded");
+      } else if (p != end) {
+        ok = end_number();
+      }
+      break;
+    case lex_id: {
+      const char *id_end = _find_id_end(p, end);
+      token_.append(p, id_end);
+      p = id_end;
+      if (token_.size() > limits_.max_string_length) {
+        return fail(at, end, "string length limit exceeded");
+      } else if (p != end) {
+        ok = end_token();
+      }
+      break;
+    }
+    default:
+      switch (state_) {
+      case st_first_value:
+      case st_first_key:
+        if (ch == ')') {
+          ++p;
+          ok = end_container();
+        } else {
+          state_ = state_ == st_first_key ? st_key : st_value;
+        }
+        break;
+      case st_value:
+        lex_key_ = false;
+        token_.clear();
+        if (++nodes_ > limits_.max_nodes) {
+          return fail(at, end, "node limit exceeded");
+        }
+        if (ch == '\'') {
+          ++p;
+          lex_ = lex_string;
+        } else if (ch == '(') {
+          if (stack_.size() >= limits_.max_depth) {
+            return fail(at, end, "depth limit exceeded");
+          }
+          ++p;
+          ok = start_container(true);
+        } else if (ch == '!') {
+          ++p;
+          lex_ = lex_bang;
+        } else if (('0' <= ch && ch <= '9') || ch == '-') {
+          lex_ = lex_number;
+        } else if (char_class(ch) & control_char_class) {
+          ok = false;
+        } else {
+          lex_ = lex_id;
+        }
+        break;
+      case st_key:
+        lex_key_ = true;
+        token_.clear();
+        if (ch == '\'') {
+          ++p;
+          lex_ = lex_string;
+        } else if (char_class(ch) & id_start_reject_class) {
+          ok = false;
+        } else {
+          lex_ = lex_id;
+        }
+        break;
+      case st_colon:
+        ok = ch == ':';
+        ++p;
+        state_ = st_value;
+        break;
+      case st_after:
+        if (stack_.empty()) {
+          ok = false;
+        } else if (ch == ',') {
+          ++p;
+          state_ = stack_.back().object ? st_key : st_value;
+        } else if (ch == ')') {
+          ++p;
+          ok = end_container();
+        } else {
+          ok = false;
+        }
+        break;
+      }
+      break;
+    }
+    if (!ok) {
+      return fail(at, end);
+    }
+  }
+  return current();
+}
+
+template <typename Handler> inline typename basic_push_parser<Handler>::status basic_push_parser<Handler>::finish() {
+  if (state_ == st_failed) {
+    return failed;
+  }
+  bool ok = true;
+  if (lex_ == lex_number) {
+    ok = end_number();
+  } else if (lex_ == lex_id) {
+    ok = end_token();
+  } else if (lex_ == lex_none && state_ == st_value && stack_.empty()) {
+    // an empty input is an empty id, as it is for parse()
+    lex_key_ = false;
+    token_.clear();
+    ok = end_token();
+  }
+  if (!ok) {
+    // the trailing number or id, which is not escaped
+    return fail_at_end(bytes_ - token_.size(), "");
+  } else if (current() != complete) {
+    return fail_at_end(bytes_, "more input");
+  }
+  return complete;
+}
+
+// parses without recursion, failing if the input breaks one of the limits; the whole input must be a single value
+inline std::string parse(value &out, const char *first, const char *last, const parse_limits &limits) {
+  value_handler handler(&out);
+  basic_push_parser<value_handler> parser(handler, limits);
+  parser.feed(first, last - first);
+  parser.finish();
+  return parser.error();
+}
+
+inline std::string parse(value &out, const std::string &s, const parse_limits &limits) {
+  return parse(out, s.data(), s.data() + s.size(), limits);
+}
+
+// an iterator over percent-encoded characters that yields them decoded; an invalid escape yields '\0', which is not valid
+// anywhere in RISON
+template <typename Iter> class percent_decoding_iterator {
+public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef char value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const char *pointer;
+  typedef char reference;
+
+protected:
+  Iter cur_, end_;
+  bool plus_as_space_;
+
+public:
+  percent_decoding_iterator() : cur_(), end_(), plus_as_space_(false) {
+  }
+  percent_decoding_iterator(const Iter &cur, const Iter &end, bool plus_as_space = false)
+      : cur_(cur), end_(end), plus_as_space_(plus_as_space) {
+  }
+  char operator*() const {
+    if (*cur_ == '%') {
+      int hi, lo;
+      Iter i = cur_;
+      if (++i == end_ || (hi = hex(*i)) < 0 || ++i == end_ || (lo = hex(*i)) < 0) {
+        return '\0';
+      }
+      return static_cast<char>(hi << 4 | lo);
+    }
+    return plus_as_space_ && *cur_ == '+' ? ' ' : static_cast<char>(*cur_);
+  }
+  percent_decoding_iterator &operator++() {
+    if (*cur_ == '%') {
+      // an invalid escape is consumed one character at a time
+      Iter i = cur_;
+      if (++i != end_ && hex(*i) >= 0 && ++i != end_ && hex(*i) >= 0) {
+        cur_ = ++i;
+        return *this;
+      }
+    }
+    ++cur_;
+    return *this;
+  }
+  percent_decoding_iterator operator++(int) {
+    percent_decoding_iterator old(*this);
+    ++*this;
+    return old;
+  }
+  bool operator==(const percent_decoding_iterator &x) const {
+    return cur_ == x.cur_;
+  }
+  bool operator!=(const percent_decoding_iterator &x) const {
+    return cur_ != x.cur_;
+  }
+  // the position in the encoded input
+  const Iter &base() const {
+    return cur_;
+  }
+
+protected:
+  static int hex(int ch) {
+    if ('0' <= ch && ch <= '9') {
+      return ch - '0';
+    }
+    ch |= 0x20;
+    return 'a' <= ch && ch <= 'f' ? ch - 'a' + 10 : -1;
+  }
+};
+
+// Parses percent-encoded RISON (e.g. a URL parameter) without decoding it into a temporary buffer.  '+' is decoded as
+// a space if plus_as_space is set.  The whole input must be a single value; errors quote the encoded input.  Returns the
+// error message, or an empty string.
+inline std::string parse_url_encoded(value &out, const char *first, const char *last, bool plus_as_space = false) {
+  const char *stop;
+  bool ok;
+  std::string err;
+  if (std::memchr(first, '%', last - first) == NULL && !(plus_as_space && std::memchr(first, '+', last - first) != NULL)) {
+    stop = parse(out, first, last, &err);
+    ok = err.empty();
+  } else {
+    typedef percent_decoding_iterator<const char *> iterator;
+    default_parse_context ctx(&out);
+    input<iterator> in(iterator(first, last, plus_as_space), iterator(last, last, plus_as_space));
+    ok = _parse(ctx, in);
+    stop = in.cur().base();
+  }
+  if (!ok || stop != last) {
+    input<const char *> raw(first, last);
+    raw.seek(stop);
+    err.clear();
+    _set_error(raw, &err);
+  }
+  return err;
+}
+
+inline std::string parse_url_encoded(value &out, const std::string &s, bool plus_as_space = false) {
+  return parse_url_encoded(out, s.data(), s.data() + s.size(), plus_as_space);
+}
+
+// Scans a query string (e.g. "_g=(...)&_a=(...)", with or without the leading '?') once, parsing the values of the
+// parameters named in names[0, n) into out[0, n).  Parameter names and values are percent-decoded (with '+' as a space)
+// before being matched and while being parsed; other parameters are skipped, and so are repeated occurrences of a
+// parameter.  The value of a missing parameter is left untouched.  Returns the number of parameters found; if err is
+// given, it receives the first error, prefixed by the name.
+inline size_t parse_query(const char *first, const char *last, const string_ref *names, value *out, size_t n,
+                          std::string *err = NULL) {
+  // which names were found; on the stack unless there are many names
+  unsigned char found_buf[64] = {};
+  std::vector<unsigned char> found_heap;
+  unsigned char *found = found_buf;
+  if (n > sizeof(found_buf)) {
+    found_heap.resize(n);
+    found = &found_heap[0];
+  }
+  size_t num_found = 0;
+  std::string decoded;
+  if (first != last && *first == '?') {
+    ++first;
+  }
+  for (const char *p = first; p != last && num_found != n;) {
+    const char *amp = static_cast<const char *>(std::memchr(p, '&', last - p));
+    const char *param_end = amp != NULL ? amp : last;
+    const char *eq = static_cast<const char *>(std::memchr(p, '=', param_end - p));
+    string_ref name(p, (eq != NULL ? eq : param_end) - p);
+    if (std::memchr(name.data(), '%', name.size()) != NULL || std::memchr(name.data(), '+', name.size()) != NULL) {
+      typedef percent_decoding_iterator<const char *> iterator;
+      decoded.assign(iterator(name.data(), name.data() + name.size(), true),
+                     iterator(name.data() + name.size(), name.data() + name.size(), true));
+      name = decoded;
+    }
+    for (size_t i = 0; i != n; ++i) {
+      if (!found[i] && names[i] == name) {
+        found[i] = 1;
+        ++num_found;
+        const char *v = eq != NULL ? eq + 1 : param_end;
+        std::string e = parse_url_encoded(out[i], v, param_end, true);
+        if (!e.empty() && err != NULL && err->empty()) {
+          *err = name.str() + ": " + e;
+        }
+        break;
+      }
+    }
+    if (param_end == last) {
+      break;
+    }
+    p = param_end + 1;
+  }
+  return num_found;
+}
+
+inline size_t parse_query(const std::string &query, const string_ref *names, value *out, size_t n, std::string *err = NULL) {
+  return parse_query(query.data(), query.data() + query.size(), names, out, n, err);
+}
+
+// Binds RISON objects to C++ structs without building a value.  The fields of a struct are listed next to it, in the
+// same namespace:
+//   struct point { int x; double y; std::vector<std::string> tags; };
+//   PICORISON_BINDING(point, PICORISON_FIELD(x) PICORISON_FIELD(y) PICORISON_OPTIONAL_FIELD(tags))
+// which defines picorison_bind(binder, point &), found through ADL.  A field may be a bool, an arithmetic type, a
+// std::string, a value, a std::vector of those, or another bound struct.  Only the first 64 fields are checked for presence.
+#define PICORISON_BINDING(type, fields)                                                                                   \
+  template <typename Binder> inline bool picorison_bind(Binder &b, type &obj) {                                           \
+    return true fields;                                                                                                   \
+  }
+#define PICORISON_FIELD(name) &&b.field(#name, obj.name, true)
+#define PICORISON_OPTIONAL_FIELD(name) &&b.field(#name, obj.name, false)
+
+// the first binding error; the path to the offending field is built while the parse unwinds
+struct _bind_error {
+  std::string what;     // empty for syntax errors
+  const char *expected; // the type the field required, if any
+  std::string path;
+  bool rewind;          // the error is about the whole value, so the input goes back to its start
+};
+
+// fails every value with a type mismatch; bind_parse_context specializations accept the values of their type
+class _bind_base {
+protected:
+  _bind_error *error_;
+  const char *expected_;
+
 public:
+  _bind_base(_bind_error *error, const char *expected) : error_(error), expected_(expected) {
+  }
   bool set_null() {
-    return false;
+    return mismatch();
   }
   bool set_bool(bool) {
-    return false;
+    return mismatch();
   }
 #ifdef PICORISON_USE_INT64
   bool set_int64(int64_t) {
-    return false;
+    return mismatch();
   }
 #endif
   bool set_number(double) {
-    return false;
+    return mismatch();
   }
   bool set_string(const std::string &) {
-    return false;
+    return mismatch();
   }
   template <typename Iter> bool parse_string(input<Iter> &) {
-    return false;
+    return mismatch();
   }
   bool parse_array_start() {
-    return false;
+    return mismatch();
   }
   template <typename Iter> bool parse_array_item(input<Iter> &, size_t) {
     return false;
   }
   bool parse_array_stop(size_t) {
-    return false;
+    return true;
   }
   bool parse_object_start() {
-    return false;
+    return mismatch();
   }
   template <typename Iter> bool parse_object_item(input<Iter> &, const std::string &) {
     return false;
   }
-};
+  // called once the value has been parsed
+  bool finish() {
+    return true;
+  }
 
-class default_parse_context {
 protected:
-  value *out_;
+  bool mismatch() {
+    error_->what = "type mismatch";
+    error_->expected = expected_;
+    error_->rewind = true;
+    return false;
+  }
+  bool out_of_range() {
+    error_->what = "value out of range";
+    error_->expected = expected_;
+    error_->rewind = true;
+    return false;
+  }
+};
 
-public:
-  default_parse_context(value *out) : out_(out) {
+template <typename T, typename Enable = void> class bind_parse_context;
+
+// the start of a value, to report type errors at its first character; only contiguous input can go back to it, other
+// input reports them where the parser stopped
+template <typename Iter> struct _bind_mark {
+  explicit _bind_mark(input<Iter> &) {
   }
-  bool set_null() {
-    *out_ = value();
-    return true;
+  void rewind(input<Iter> &) const {
   }
-  bool set_bool(bool b) {
-    *out_ = value(b);
-    return true;
+};
+
+template <typename Ch> struct _bind_mark<Ch *> {
+  Ch *start_;
+  explicit _bind_mark(input<Ch *> &in) : start_(in.cur()) {
   }
-#ifdef PICORISON_USE_INT64
-  bool set_int64(int64_t i) {
-    *out_ = value(i);
-    return true;
+  void rewind(input<Ch *> &in) const {
+    in.seek(start_);
   }
-#endif
-  bool set_number(double f) {
-    *out_ = value(f);
+};
+
+template <typename T, typename Iter> inline bool _bind_value(T &out, input<Iter> &in, _bind_error *error) {
+  _bind_mark<Iter> mark(in);
+  bind_parse_context<T> ctx(&out, error);
+  if (_parse(ctx, in) && ctx.finish()) {
     return true;
   }
-  bool set_string(const std::string &s) {
-    *out_ = value(s);
-    return true;
+  if (error->rewind) {
+    mark.rewind(in);
+    error->rewind = false;
   }
-  template <typename Iter> bool parse_string(input<Iter> &in) {
-    // TODO: use set_string()
-    *out_ = value(string_type, false);
-    return _parse_string(out_->get<std::string>(), in);
+  return false;
+}
+
+// parses the value of the field named key, if the struct has one
+template <typename Iter> struct _bind_field_parser {
+  const std::string &key_;
+  input<Iter> &in_;
+  _bind_error *error_;
+  size_t index_;
+  bool ok_;
+  template <typename F> bool field(const char *name, F &f, bool) {
+    if (key_ != name) {
+      ++index_;
+      return true;
+    }
+    ok_ = _bind_value(f, in_, error_);
+    if (!ok_ && !error_->what.empty()) {
+      error_->path.insert(0, std::string(".") + name);
+    }
+    return false;
   }
-  bool parse_array_start() {
-    *out_ = value(array_type, false);
+};
+
+// finds the first required field that was not seen
+struct _bind_required_checker {
+  uint64_t seen_;
+  size_t index_;
+  const char *missing_;
+  template <typename F> bool field(const char *name, F &, bool required) {
+    if (required && index_ < 64 && (seen_ >> index_ & 1) == 0) {
+      missing_ = name;
+      return false;
+    }
+    ++index_;
     return true;
   }
-  template <typename Iter> bool parse_array_item(input<Iter> &in, size_t) {
-    array &a = out_->get<array>();
-    a.push_back(value());
-    default_parse_context ctx(&a.back());
-    return _parse(ctx, in);
-  }
-  bool parse_array_stop(size_t) {
-    return true;
+};
+
+// a struct declared with PICORISON_BINDING; keys without a field are skipped, and the last occurrence of a key wins
+template <typename T, typename Enable> class bind_parse_context : public _bind_base {
+protected:
+  T *out_;
+  uint64_t seen_;
+
+public:
+  bind_parse_context(T *out, _bind_error *error) : _bind_base(error, "an object"), out_(out), seen_(0) {
   }
   bool parse_object_start() {
-    *out_ = value(object_type, false);
     return true;
   }
   template <typename Iter> bool parse_object_item(input<Iter> &in, const std::string &key) {
-    object &o = out_->get<object>();
-    default_parse_context ctx(&o[key]);
-    return _parse(ctx, in);
+    _bind_field_parser<Iter> parser = {key, in, error_, 0, false};
+    if (picorison_bind(parser, *out_)) {
+      null_parse_context ctx;
+      return _parse(ctx, in);
+    }
+    if (parser.index_ < 64) {
+      seen_ |= uint64_t(1) << parser.index_;
+    }
+    return parser.ok_;
+  }
+  bool finish() {
+    _bind_required_checker checker = {seen_, 0, NULL};
+    if (!picorison_bind(checker, *out_)) {
+      error_->what = std::string("missing field ") + checker.missing_;
+      error_->expected = NULL;
+      return false;
+    }
+    return true;
   }
-
-private:
-  default_parse_context(const default_parse_context &);
-  default_parse_context &operator=(const default_parse_context &);
 };
 
-class null_parse_context {
-public:
-  struct dummy_str {
-    void push_back(int) {
-    }
-  };
+template <> class bind_parse_context<bool> : public _bind_base {
+protected:
+  bool *out_;
 
 public:
-  null_parse_context() {
+  bind_parse_context(bool *out, _bind_error *error) : _bind_base(error, "a boolean"), out_(out) {
   }
-  bool set_null() {
+  bool set_bool(bool b) {
+    *out_ = b;
     return true;
   }
-  bool set_bool(bool) {
-    return true;
+};
+
+// integers must be integral and in the range of the field's type
+template <typename T>
+class bind_parse_context<T, typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>::type>
+    : public _bind_base {
+protected:
+  T *out_;
+
+public:
+  bind_parse_context(T *out, _bind_error *error)
+      : _bind_base(error, std::is_integral<T>::value ? "an integer" : "a number"), out_(out) {
   }
 #ifdef PICORISON_USE_INT64
-  bool set_int64(int64_t) {
+  bool set_int64(int64_t i) {
+    if (std::is_integral<T>::value &&
+        (i < 0 ? !std::is_signed<T>::value || i < static_cast<int64_t>(std::numeric_limits<T>::min())
+               : static_cast<uint64_t>(i) > static_cast<uint64_t>(std::numeric_limits<T>::max()))) {
+      return out_of_range();
+    }
+    *out_ = static_cast<T>(i);
     return true;
   }
 #endif
-  bool set_number(double) {
+  bool set_number(double f) {
+    if (std::is_integral<T>::value) {
+      if (f != std::floor(f)) {
+        return mismatch();
+      }
+      if (!(f >= static_cast<double>(std::numeric_limits<T>::min()) &&
+            f < static_cast<double>(std::numeric_limits<T>::max()) + 1.0)) {
+        return out_of_range();
+      }
+    }
+    *out_ = static_cast<T>(f);
     return true;
   }
-  bool set_string(const std::string &) {
+};
+
+template <> class bind_parse_context<std::string> : public _bind_base {
+protected:
+  std::string *out_;
+
+public:
+  bind_parse_context(std::string *out, _bind_error *error) : _bind_base(error, "a string"), out_(out) {
+  }
+  bool set_string(const std::string &s) {
+    *out_ = s;
     return true;
   }
   template <typename Iter> bool parse_string(input<Iter> &in) {
-    dummy_str s;
-    return _parse_string(s, in);
+    out_->clear();
+    return _parse_string(*out_, in);
+  }
+};
+
+template <typename T> class bind_parse_context<std::vector<T> > : public _bind_base {
+protected:
+  std::vector<T> *out_;
+
+public:
+  bind_parse_context(std::vector<T> *out, _bind_error *error) : _bind_base(error, "an array"), out_(out) {
   }
   bool parse_array_start() {
+    out_->clear();
     return true;
   }
-  template <typename Iter> bool parse_array_item(input<Iter> &in, size_t) {
-    return _parse(*this, in);
-  }
-  bool parse_array_stop(size_t) {
+  template <typename Iter> bool parse_array_item(input<Iter> &in, size_t idx) {
+    // bound into a local, as the elements of std::vector<bool> cannot be referenced
+    T item = T();
+    bool ok = _bind_value(item, in, error_);
+    out_->push_back(std::move(item));
+    if (!ok) {
+      if (!error_->what.empty()) {
+        char buf[32];
+        SNPRINTF(buf, sizeof(buf), "[%lu]", static_cast<unsigned long>(idx));
+        error_->path.insert(0, buf);
+      }
+      return false;
+    }
     return true;
   }
-  bool parse_object_start() {
-    return true;
+};
+
+// a field of any shape
+template <> class bind_parse_context<value> : public default_parse_context {
+public:
+  bind_parse_context(value *out, _bind_error *) : default_parse_context(out) {
   }
-  template <typename Iter> bool parse_object_item(input<Iter> &in, const std::string &) {
-    return _parse(*this, in);
+  bool finish() {
+    return true;
   }
-
-private:
-  null_parse_context(const null_parse_context &);
-  null_parse_context &operator=(const null_parse_context &);
 };
 
-// obsolete, use the version below
-template <typename Iter> inline std::string parse(value &out, Iter &pos, const Iter &last) {
-  std::string err;
-  pos = parse(out, pos, last, &err);
-  return err;
+template <typename Iter> inline void _set_error(input<Iter> &in, const _bind_error &e, parse_error &err) {
+  if (e.what.empty()) {
+    _set_error(in, err);
+    return;
+  }
+  in.position(err.offset, err.line, err.column);
+  err.expected = e.expected != NULL ? e.expected : "";
+  err.message = e.what;
+  if (!e.path.empty()) {
+    err.message += " in ";
+    err.message.append(e.path, e.path[0] == '.' ? 1 : 0, std::string::npos);
+  }
+  if (e.expected != NULL) {
+    err.message += std::string(" (expected ") + e.expected + ")";
+  }
+  std::string near;
+  _set_error(in, &near, "");
+  err.message += near;
 }
 
-template <typename Context, typename Iter> inline Iter _parse(Context &ctx, const Iter &first, const Iter &last, std::string *err) {
+// Parses a value into out, which is usually a struct declared with PICORISON_BINDING.  Besides syntax errors, reports
+// "type mismatch in pts[1].y (expected a number)", "value out of range in ..." and "missing field y in pts[1]".
+template <typename T, typename Iter> inline Iter parse_into(T &out, const Iter &first, const Iter &last, parse_error &err) {
   input<Iter> in(first, last);
-  if (!_parse(ctx, in) && err != NULL) {
-    char buf[64];
-    SNPRINTF(buf, sizeof(buf), "syntax error at line %d near: ", in.line());
-    *err = buf;
-    while (1) {
-      int ch = in.getc();
-      if (ch == -1 || ch == '\n') {
-        break;
-      } else if (ch >= ' ') {
-        err->push_back(static_cast<char>(ch));
-      }
-    }
+  _bind_error e = {std::string(), NULL, std::string(), false};
+  err = parse_error();
+  if (!_bind_value(out, in, &e)) {
+    _set_error(in, e, err);
   }
   return in.cur();
 }
 
-template <typename Iter> inline Iter parse(value &out, const Iter &first, const Iter &last, std::string *err) {
-  default_parse_context ctx(&out);
-  return _parse(ctx, first, last, err);
+template <typename T, typename Iter> inline Iter parse_into(T &out, const Iter &first, const Iter &last, std::string *err) {
+  parse_error e;
+  Iter end = parse_into(out, first, last, e);
+  if (err != NULL) {
+    *err = e.message;
+  }
+  return end;
 }
 
-inline std::string parse(value &out, const std::string &s) {
+template <typename T> inline std::string parse_into(T &out, const std::string &s) {
   std::string err;
-  parse(out, s.begin(), s.end(), &err);
+  parse_into(out, s.data(), s.data() + s.size(), &err);
   return err;
 }
 
-inline std::string parse(value &out, std::istream &is) {
-  std::string err;
-  parse(out, std::istreambuf_iterator<char>(is.rdbuf()), std::istreambuf_iterator<char>(), &err);
-  return err;
-}
+#ifdef PICORISON_USE_THREADS
+template <typename Iter> struct _batch_worker {
+  Iter first_;
+  size_t n_;
+  std::vector<value> *out_;
+  std::vector<std::string> *errs_;
+  std::atomic<size_t> *next_;
 
-template <typename T> struct last_error_t { static std::string s; };
-template <typename T> std::string last_error_t<T>::s;
+  void operator()() const {
+    const size_t grain = 64;
+    for (size_t begin; (begin = next_->fetch_add(grain)) < n_;) {
+      for (size_t i = begin, end = std::min(begin + grain, n_); i != end; ++i) {
+        string_ref s(first_[i]);
+        try {
+          parse((*out_)[i], s.begin(), s.end(), &(*errs_)[i]);
+        } catch (std::exception &e) {
+          // thrown through PICORISON_ASSERT, e.g. for numbers out of the range of double
+          (*errs_)[i] = e.what();
+        }
+      }
+    }
+  }
+};
 
-inline void set_last_error(const std::string &s) {
-  last_error_t<bool>::s = s;
+// Parses the strings in [first, last) (anything convertible to string_ref) on num_threads threads (by default, one per
+// core), storing the values and the error messages in input order.  Threads take the inputs in batches of 64 from a shared
+// counter, so uneven input sizes do not leave threads idle.
+template <typename Iter>
+inline void parse_batch(Iter first, Iter last, std::vector<value> &out, std::vector<std::string> &errs, unsigned num_threads = 0) {
+  const size_t n = static_cast<size_t>(last - first);
+  out.assign(n, value());
+  errs.assign(n, std::string());
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, (n + 63) / 64));
+  std::atomic<size_t> next(0);
+  _batch_worker<Iter> worker = {first, n, &out, &errs, &next};
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads; ++i) {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t i = 0; i != threads.size(); ++i) {
+    threads[i].join();
+  }
 }
 
-inline const std::string &get_last_error() {
-  return last_error_t<bool>::s;
+// finds the items of the top-level array in [first, last), which must be the whole input; returns false (setting err) if
+// the input is not an array
+inline bool _split_array(const char *first, const char *last, std::vector<std::pair<const char *, const char *> > &items,
+                         std::string *err) {
+  items.clear();
+  const char *p = first;
+  if (last - p >= 2 && p[0] == '!' && p[1] == '(') {
+    p += 2;
+    bool closed = p != last && *p == ')';
+    if (closed) {
+      ++p;
+    }
+    while (!closed) {
+      const char *item_end = _skip_value(p, last);
+      if (item_end == NULL || item_end == last || (*item_end != ',' && *item_end != ')')) {
+        p = item_end == NULL ? last : item_end;
+        break;
+      }
+      items.push_back(std::make_pair(p, item_end));
+      p = item_end + 1;
+      closed = *item_end == ')';
+    }
+    if (closed && p == last) {
+      return true;
+    }
+  }
+  input<const char *> in(first, last);
+  in.seek(p);
+  _set_error(in, err);
+  return false;
 }
 
-inline bool operator==(const value &x, const value &y) {
-  if (x.is<null>())
-    return y.is<null>();
-#define PICORISON_CMP(type)                                                                                                         \
-  if (x.is<type>())                                                                                                                \
-  return y.is<type>() && x.get<type>() == y.get<type>()
-  PICORISON_CMP(bool);
-  PICORISON_CMP(double);
-  PICORISON_CMP(std::string);
-  PICORISON_CMP(array);
-  PICORISON_CMP(object);
-#undef PICORISON_CMP
-  PICORISON_ASSERT(0);
-#ifdef _MSC_VER
-  __assume(0);
-#endif
-  return false;
+template <typename Callback> struct _array_worker {
+  const std::vector<std::pair<const char *, const char *> > *items_;
+  const char *last_;
+  Callback *callback_;
+  std::atomic<size_t> *next_;
+  std::atomic<bool> *failed_;
+  size_t error_index_;
+  std::string err_;
+
+  void operator()() {
+    const size_t grain = 16, n = items_->size();
+    error_index_ = n;
+    for (size_t begin; !failed_->load() && (begin = next_->fetch_add(grain)) < n;) {
+      for (size_t i = begin, end = std::min(begin + grain, n); i != end; ++i) {
+        if (!parse_item(i)) {
+          error_index_ = i;
+          failed_->store(true);
+          return;
+        }
+      }
+    }
+  }
+  bool parse_item(size_t i) {
+    const std::pair<const char *, const char *> &item = (*items_)[i];
+    try {
+      value v;
+      const char *end = parse(v, item.first, last_, &err_);
+      if (!err_.empty()) {
+        return false;
+      } else if (end == item.second && (*callback_)(i, v)) {
+        return true;
+      }
+      // trailing characters, or rejected by the callback (as a parse context returning false)
+      input<const char *> in(item.first, last_);
+      in.seek(end);
+      _set_error(in, &err_);
+      return false;
+    } catch (std::exception &e) {
+      err_ = e.what();
+      return false;
+    }
+  }
+};
+
+template <typename Callback>
+inline std::string _parse_array_items(const std::vector<std::pair<const char *, const char *> > &items, const char *last,
+                                      Callback &callback, unsigned num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(num_threads, (items.size() + 15) / 16)));
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  _array_worker<Callback> proto = {&items, last, &callback, &next, &failed, 0, std::string()};
+  std::vector<_array_worker<Callback> > workers(num_threads, proto);
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads; ++i) {
+    threads.push_back(std::thread(std::ref(workers[i])));
+  }
+  workers[0]();
+  for (size_t i = 0; i != threads.size(); ++i) {
+    threads[i].join();
+  }
+  // batches are taken in index order, so the lowest failing index among the workers is the first failure overall
+  size_t error_index = items.size();
+  std::string err;
+  for (size_t i = 0; i != workers.size(); ++i) {
+    if (workers[i].error_index_ < error_index) {
+      error_index = workers[i].error_index_;
+      err = workers[i].err_;
+    }
+  }
+  return err;
 }
 
-inline bool operator!=(const value &x, const value &y) {
-  return !(x == y);
+// Parses a top-level array on num_threads threads (by default, one per core), calling callback(index, value&) for each of
+// its items.  The items are first delimited by a quick scan for parentheses and quotes, then parsed in parallel, so the
+// callback is called concurrently from several threads and not in index order.  The callback returns false to stop the
+// parse.  The whole input must be the array.  Returns the error of the first failing item, or an empty string.
+template <typename Callback>
+inline std::string parse_array_parallel(const char *first, const char *last, Callback callback, unsigned num_threads = 0) {
+  std::vector<std::pair<const char *, const char *> > items;
+  std::string err;
+  if (!_split_array(first, last, items, &err)) {
+    return err;
+  }
+  return _parse_array_items(items, last, callback, num_threads);
+}
+
+struct _array_store {
+  array *out_;
+  bool operator()(size_t i, value &v) const {
+    (*out_)[i].swap(v);
+    return true;
+  }
+};
+
+// parses a top-level array in parallel into out (see above)
+inline std::string parse_array_parallel(value &out, const char *first, const char *last, unsigned num_threads = 0) {
+  std::vector<std::pair<const char *, const char *> > items;
+  std::string err;
+  if (!_split_array(first, last, items, &err)) {
+    return err;
+  }
+  out = value(array_type, false);
+  array &a = out.get<array>();
+  a.resize(items.size());
+  _array_store store = {&a};
+  return _parse_array_items(items, last, store, num_threads);
 }
+#endif
 }
 
 inline std::istream &operator>>(std::istream &is, picorison::value &x) {
@@ -1050,7 +5314,14 @@ inline std::istream &operator>>(std::istream &is, picorison::value &x) {
 }
 
 inline std::ostream &operator<<(std::ostream &os, const picorison::value &x) {
-  x.serialize(std::ostream_iterator<char>(os));
+  std::ostream::sentry ok(os);
+  if (ok) {
+    picorison::streambuf_sink sink(os.rdbuf());
+    picorison::serialize(x, sink);
+    if (!sink.good()) {
+      os.setstate(std::ios::badbit);
+    }
+  }
   return os;
 }
 #ifdef _MSC_VER
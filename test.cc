@@ -40,6 +40,99 @@ using namespace std;
 #include <sstream>
 #include <limits>
 
+// collects the value of key "x" from an object, skipping everything else
+class skip_context : public picorison::deny_parse_context {
+public:
+  picorison::value x;
+  bool parse_object_start() {
+    return true;
+  }
+  template <typename Iter> bool parse_object_item(picorison::input<Iter> &in, const std::string &key) {
+    if (key != "x") {
+      return picorison::skip(in);
+    }
+    picorison::default_parse_context ctx(&x);
+    return picorison::_parse(ctx, in);
+  }
+};
+
+// structs bound with PICORISON_BINDING
+struct bound_point {
+  int x;
+  double y;
+  std::vector<std::string> tags;
+};
+PICORISON_BINDING(bound_point, PICORISON_FIELD(x) PICORISON_FIELD(y) PICORISON_OPTIONAL_FIELD(tags))
+
+struct bound_shape {
+  std::string name;
+  bool closed;
+  std::vector<bound_point> pts;
+  picorison::value extra;
+  unsigned char weight;
+  std::vector<bool> flags;
+};
+PICORISON_BINDING(bound_shape, PICORISON_FIELD(name) PICORISON_FIELD(closed) PICORISON_FIELD(pts)
+                                   PICORISON_OPTIONAL_FIELD(extra) PICORISON_OPTIONAL_FIELD(weight)
+                                       PICORISON_OPTIONAL_FIELD(flags))
+
+#ifdef PICORISON_USE_THREADS
+// records the "id" of each item passed to parse_array_parallel
+struct id_collector {
+  std::vector<double> *ids;
+  bool operator()(size_t idx, picorison::value &v) const {
+    (*ids)[idx] = v.get("id").get<double>();
+    return idx != 777;
+  }
+};
+#endif
+
+// counts the events of event_parser and records where strings point
+struct event_counter {
+  size_t values, keys, depth, max_depth;
+  std::vector<const char *> strings;
+  event_counter() : values(0), keys(0), depth(0), max_depth(0), strings() {
+  }
+  bool on_null() {
+    return ++values != 0;
+  }
+  bool on_bool(bool) {
+    return ++values != 0;
+  }
+#ifdef PICORISON_USE_INT64
+  bool on_int64(int64_t) {
+    return ++values != 0;
+  }
+#endif
+  bool on_number(double) {
+    return ++values != 0;
+  }
+  bool on_string(const picorison::string_ref &s) {
+    strings.push_back(s.data());
+    return s != "stop" && ++values != 0;
+  }
+  bool on_start_array() {
+    max_depth = std::max(max_depth, ++depth);
+    return true;
+  }
+  bool on_end_array(size_t) {
+    --depth;
+    return ++values != 0;
+  }
+  bool on_start_object() {
+    max_depth = std::max(max_depth, ++depth);
+    return true;
+  }
+  bool on_key(const picorison::string_ref &key) {
+    strings.push_back(key.data());
+    return ++keys != 0;
+  }
+  bool on_end_object(size_t) {
+    --depth;
+    return ++values != 0;
+  }
+};
+
 int main(void)
 {
   // constructors
@@ -115,11 +208,12 @@ int main(void)
   TEST("'abc33-4'", "abc33-4");
   TEST("'Amazing!!'", "'Amazing!!'");
   TEST("'What!'s RISON?'", "'What!'s RISON?'");
-  TEST("72057594037927936", "72057594037927936");
 #ifdef PICORISON_USE_INT64
+  TEST("72057594037927936", "72057594037927936");
   TEST("144115188075855872", "144115188075855872");
 #else
-  TEST("144115188075855872", "1.4411518807585587e17");
+  TEST("72057594037927936", "72057594037927940");
+  TEST("144115188075855872", "144115188075855870");
 #endif
 #undef TEST
 
@@ -192,6 +286,148 @@ int main(void)
   TEST("'abc\nd'", "1 near: ");
   TEST("(123:456)", "1 near: :456)");  // Unquoted fully numeric key isn't allowed
   TEST("( 'a': !t )", "1 near:  'a': !t )");  // No whitespace is permitted except inside quoted strings
+  TEST("!(1,'a\nb')", "1 near: ");
+#undef TEST
+
+#define TEST(rison) do {        \
+    picorison::value v1, v2;          \
+    std::string s = rison;        \
+    std::istringstream iss(s);      \
+    string err1 = picorison::parse(v1, s);  \
+    string err2 = picorison::parse(v2, iss);  \
+    is(err1, err2, "contiguous and stream input agree on: " rison);  \
+    _ok(v1 == v2, "contiguous and stream input agree on value: " rison);  \
+  } while (0)
+  TEST("(a:!(1,2,'x y'),b:(c:!n))");
+  TEST("!(1,!x)");
+  TEST("!\n");
+  TEST("'unterminated");
+  TEST("(a:1");
+#undef TEST
+
+  {
+    // quoted strings long enough to cross the vectorized scanner's block boundaries
+    bool ok = true;
+    for (size_t len = 0; len < 48 && ok; ++len) {
+      for (size_t pos = 0; pos <= len && ok; ++pos) {
+        const char *specials[] = {"!!", "!'", "\n", "\x7f", "\xe3\x82\xaf"};
+        for (size_t k = 0; k < sizeof(specials) / sizeof(specials[0]); ++k) {
+          std::string body(len, 'x');
+          body.insert(pos, specials[k]);
+          std::string rison = "'" + body + "'";
+          picorison::value v1, v2;
+          std::istringstream iss(rison);
+          std::string err1 = picorison::parse(v1, rison), err2 = picorison::parse(v2, iss);
+          ok = err1 == err2 && v1 == v2;
+        }
+      }
+    }
+    _ok(ok, "contiguous and stream input agree on long quoted strings");
+  }
+
+  {
+    // every byte value at every offset of an unquoted id, as a value and as a key
+    bool ok = true;
+    for (int c = 1; c < 256 && ok; ++c) {
+      for (size_t pos = 0; pos < 40 && ok; ++pos) {
+        std::string id(40, 'a');
+        id[pos] = static_cast<char>(c);
+        const std::string inputs[] = {id, "(" + id + ":1)", "!(" + id + ")"};
+        for (size_t k = 0; k < 3; ++k) {
+          const std::string &in = inputs[k];
+          picorison::value v1, v2;
+          std::string err1, err2;
+          const char *end1 = picorison::parse(v1, in.data(), in.data() + in.size(), &err1);
+          std::string::const_iterator end2 = picorison::parse(v2, in.begin(), in.end(), &err2);
+          ok = ok && err1 == err2 && v1 == v2 && end1 - in.data() == end2 - in.begin();
+        }
+      }
+    }
+    _ok(ok, "contiguous and iterator input agree on unquoted ids");
+  }
+
+  {
+    // numbers must convert exactly as strtod does
+    uint64_t state = 88172645463325252ULL;
+    size_t mismatches = 0;
+    for (int i = 0; i < 200000; ++i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      char buf[64];
+      switch (i % 4) {
+      case 0: { // arbitrary finite doubles with all 17 digits
+        double d;
+        uint64_t bits = state;
+        if ((bits >> 52 & 0x7ff) == 0x7ff) {
+          bits ^= uint64_t(1) << 52; // not inf nor NaN
+        }
+        memcpy(&d, &bits, sizeof(d));
+        snprintf(buf, sizeof(buf), "%.17g", d);
+        break;
+      }
+      case 1: // short decimals taking the fast path
+        snprintf(buf, sizeof(buf), "%s%u.%ue%s%u", state & 1 ? "-" : "", static_cast<unsigned>(state >> 8 & 0xfffff),
+                 static_cast<unsigned>(state >> 32 & 0xffff), state & 2 ? "-" : "", static_cast<unsigned>(state >> 48 & 31));
+        break;
+      case 2: // integers around 2^53 and 2^64
+        snprintf(buf, sizeof(buf), "%llu%u", static_cast<unsigned long long>(state >> (state & 15)),
+                 static_cast<unsigned>(state & 7));
+        break;
+      default: // many digits, leading zeros and long fractions
+        snprintf(buf, sizeof(buf), "0.000%llu%llue-%u", static_cast<unsigned long long>(state),
+                 static_cast<unsigned long long>(state >> 3), static_cast<unsigned>(state >> 58));
+        break;
+      }
+      std::string text(buf);
+      std::string::size_type pos = text.find("e+");
+      if (pos != std::string::npos) {
+        text.erase(pos + 1, 1);
+      }
+      double expected = strtod(buf, NULL);
+      picorison::value v;
+      std::string err = picorison::parse(v, text);
+      if (!err.empty() || !v.is<double>() || memcmp(&v.get<double>(), &expected, sizeof(double)) != 0) {
+        if (mismatches++ < 5) {
+          printf("# number mismatch: %s\n", text.c_str());
+        }
+      }
+    }
+    is(mismatches, size_t(0), "numbers convert exactly as strtod does");
+  }
+
+#define TEST(rison, type, expected, rest) do {        \
+    picorison::value v;          \
+    const char *s = rison;        \
+    std::string err;        \
+    const char *end = picorison::parse(v, s, s + strlen(s), &err);  \
+    _ok(err.empty(), rison " number no error");      \
+    _ok(v.is<type>() && v.get<type>() == expected, rison " number value"); \
+    is(std::string(end), std::string(rest), rison " number end");    \
+  } while (0)
+  TEST("-0", double, 0.0, "");
+  TEST("1.", double, 1.0, "");
+  TEST("-.5", double, -0.5, "");
+  TEST("1e-0", double, 1.0, "");
+  TEST("0.1e1", double, 1.0, "");
+  TEST("123e25", double, 123e25, "");
+  TEST("00012a", double, 12.0, "a");
+  TEST("1.5)", double, 1.5, ")");
+#undef TEST
+
+#define TEST(rison, msg) do {        \
+    picorison::value v;          \
+    const char *s = rison;        \
+    string err = picorison::parse(v, s, s + strlen(s));  \
+    is(err, string("syntax error at line 1 near: " msg), rison " is not a number");  \
+  } while (0)
+  TEST("-", "");
+  TEST("1.2.3)", ")");
+  TEST("1e)", ")");
+  TEST("1e-", "");
+  TEST("--1,2", ",2");
+  TEST("1-2e5.", "");
+  TEST("-e5", "");
 #undef TEST
 
   {
@@ -363,5 +599,1049 @@ int main(void)
     is(*reststr, 'a', "should point at the next char");
   }
 
+  {
+    picorison::borrowed_document doc;
+    std::string err;
+    const char *s = R"((a:!(1,!t,!n,'x y',id-1,''),'b!'c':'it!'s',long_key_name_here:(n:-2.5e-3),d:()))";
+    const char *end = picorison::parse(doc, s, s + strlen(s), &err);
+    _ok(err.empty(), "borrowed no error");
+    is(*end, '\0', "borrowed read to eof");
+    const picorison::borrowed_value &root = doc.root();
+    _ok(root.is<picorison::borrowed_value::object>(), "borrowed root is object");
+    is(root.get<picorison::borrowed_value::object>().size(), size_t(4), "borrowed object size");
+    const picorison::borrowed_value::member &first = root.get<picorison::borrowed_value::object>()[0];
+    _ok(first.first == "a" && first.first.data() == s + 1, "borrowed key refers to the input");
+    const picorison::borrowed_value &a = root.get("a");
+    is(a.get<picorison::borrowed_value::array>().size(), size_t(6), "borrowed array size");
+    _ok(a.get(0).is<double>() && a.get(0).get<double>() == 1, "borrowed number");
+    _ok(a.get(1).is<bool>() && a.get(1).get<bool>(), "borrowed bool");
+    _ok(a.get(2).is<picorison::null>(), "borrowed null");
+    picorison::string_ref xy = a.get(3).get<picorison::string_ref>();
+    _ok(xy == "x y" && xy.data() == s + 14, "borrowed string refers to the input");
+    picorison::string_ref id = a.get(4).get<picorison::string_ref>();
+    _ok(id == "id-1" && id.data() == s + 19, "borrowed id refers to the input");
+    _ok(a.get(5).get<picorison::string_ref>().empty(), "borrowed empty string");
+    picorison::string_ref escaped = root.get("b'c").get<picorison::string_ref>();
+    _ok(escaped == "it's" && !(s <= escaped.data() && escaped.data() < end), "borrowed escaped string is unescaped");
+    _ok(root.get("long_key_name_here").get("n").get<double>() == -2.5e-3, "borrowed nested object");
+    _ok(root.get("d").get<picorison::borrowed_value::object>().empty(), "borrowed empty object");
+    _ok(!root.contains("z"), "borrowed does not contain missing key");
+    picorison::value v;
+    picorison::parse(v, s, s + strlen(s));
+    _ok(root.to_value() == v, "borrowed converts to the same value");
+  }
+
+  {
+    const char *inputs[] = {"!Foa", "(]", "'abc\nd'", "!(1,!x)", "(a:1", "( 'a': !t )", "(123:456)", "!(1,2)rest"};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+      const char *s = inputs[i];
+      picorison::borrowed_document doc;
+      picorison::value v;
+      std::string err1, err2;
+      const char *end1 = picorison::parse(doc, s, s + strlen(s), &err1);
+      const char *end2 = picorison::parse(v, s, s + strlen(s), &err2);
+      if (err1.empty() != err2.empty() || (err1.empty() && (end1 != end2 || doc.root().to_value() != v))) {
+        printf("# borrowed mismatch: %s [%s] [%s]\n", s, err1.c_str(), err2.c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "borrowed and value parse agree on success and failure");
+  }
+
+  {
+    picorison::arena a(64);
+    bool aligned = true;
+    for (size_t i = 1; i < 100; ++i) {
+      void *p = a.allocate(i, i % 2 ? 8 : 16);
+      aligned = aligned && reinterpret_cast<uintptr_t>(p) % (i % 2 ? 8 : 16) == 0;
+      memset(p, 0xff, i);
+    }
+    _ok(aligned, "arena allocations are aligned");
+    char *big = static_cast<char *>(a.allocate(100000));
+    memset(big, 0, 100000);
+    size_t capacity = a.capacity();
+    _ok(capacity >= 100000 + 99 * 100 / 2, "arena grows for large allocations");
+    a.clear();
+    is(a.capacity(), capacity, "arena keeps its capacity in one chunk when cleared");
+    picorison::string_ref copied = a.copy("hello");
+    _ok(copied == "hello", "arena copies strings");
+  }
+
+  {
+    std::string rison = "!(";
+    for (int i = 0; i < 1000; ++i) {
+      rison += i != 0 ? "," : "";
+      rison += "(id:" + std::to_string(i) + ",name:'it!'s " + std::to_string(i) + "',tags:!(a,b,c))";
+    }
+    rison += ")";
+    picorison::borrowed_document doc;
+    std::string err;
+    picorison::parse(doc, rison.data(), rison.data() + rison.size(), &err);
+    _ok(err.empty(), "arena document no error");
+    size_t capacity = doc.get_arena().capacity();
+    picorison::parse(doc, rison.data(), rison.data() + rison.size(), &err);
+    _ok(err.empty(), "arena document reparse no error");
+    is(doc.get_arena().capacity(), capacity, "arena document reuses its memory when reparsing");
+    const picorison::borrowed_value &item = doc.root().get(999);
+    _ok(item.get("name").get<picorison::string_ref>() == "it's 999", "arena document unescaped string");
+    _ok(item.get("tags").get(2).get<picorison::string_ref>() == "c", "arena document nested array");
+    picorison::value v;
+    picorison::parse(v, rison);
+    _ok(doc.root().to_value() == v, "arena document converts to the same value");
+  }
+
+  {
+    picorison::flat_map<std::string, int> m;
+    m["b"] = 2;
+    m["d"] = 4;
+    m["a"] = 1;
+    _ok(m.insert(std::make_pair(std::string("c"), 3)).second, "flat_map insert new key");
+    _ok(!m.insert(std::make_pair(std::string("c"), 30)).second, "flat_map insert existing key");
+    std::string keys;
+    for (picorison::flat_map<std::string, int>::const_iterator i = m.begin(); i != m.end(); ++i) {
+      keys += i->first;
+    }
+    is(keys, std::string("abcd"), "flat_map iterates in key order");
+    _ok(m.find("c") != m.end() && m.find("c")->second == 3, "flat_map find");
+    _ok(m.find("z") == m.end() && m.count("z") == 0, "flat_map find missing");
+    is(m.erase("b"), size_t(1), "flat_map erase");
+    is(m.size(), size_t(3), "flat_map size");
+    picorison::flat_map<std::string, int> m2;
+    m2["d"] = 4;
+    m2["c"] = 3;
+    m2["a"] = 1;
+    _ok(m == m2, "flat_map equality");
+  }
+
+  {
+    picorison::value v(picorison::object_type, false);
+    picorison::object &o = v.get<picorison::object>();
+    o["zeta"] = picorison::value(1.0);
+    o["alpha"] = picorison::value(2.0);
+    o["mid"] = picorison::value(3.0);
+    is(v.serialize(), std::string("(alpha:2,mid:3,zeta:1)"), "objects serialize in key order");
+  }
+
+  {
+    picorison::tape_document doc;
+    std::string err = doc.parse(R"((a:!(1,!t,!n,'x y',id-1,''),'b!'c':'it!'s',n:(x:-2.5e-3),d:(),e:!()))");
+    _ok(err.empty(), "tape no error");
+    picorison::tape_element root = doc.root();
+    _ok(root.is<picorison::tape_element::object>(), "tape root is object");
+    is(root.size(), size_t(5), "tape object size");
+    picorison::tape_element a = root.get("a");
+    is(a.size(), size_t(6), "tape array size");
+    _ok(a.get(0).is<double>() && a.get(0).get<double>() == 1, "tape number");
+    _ok(a.get(1).is<bool>() && a.get(1).get<bool>(), "tape bool");
+    _ok(a.get(2).is<picorison::null>(), "tape null");
+    _ok(a.get(3).get<picorison::string_ref>() == "x y", "tape string");
+    _ok(a.get(4).get<picorison::string_ref>() == "id-1", "tape id");
+    _ok(a.get(5).get<picorison::string_ref>().empty(), "tape empty string");
+    _ok(a.get(6).is<picorison::null>() && !a.contains(6), "tape index out of range");
+    _ok(root.get("b'c").get<picorison::string_ref>() == "it's", "tape unescaped key and string");
+    _ok(root.get("n").get("x").get<double>() == -2.5e-3, "tape nested object");
+    _ok(root.get("d").size() == 0 && root.get("e").size() == 0, "tape empty containers");
+    _ok(!root.contains("z") && root.get("z").is<picorison::null>(), "tape missing key");
+    std::string keys;
+    picorison::tape_element::object members = root.get<picorison::tape_element::object>();
+    for (picorison::tape_element::object::const_iterator i = members.begin(); i != members.end(); ++i) {
+      keys += i.key().str();
+    }
+    is(keys, std::string("ab'cnde"), "tape object iterates in input order");
+  }
+
+  {
+    std::vector<std::string> inputs = {"!n", "!t", "!f", "0", "-1.5e10", "abc", "''", "'a!!b!'c'", "()", "!()", "(a:(b:!(1,2,(c:3))))",
+                                       "(a:1,a:2)", "(:1)", "!(,)", "''", "!('(',':',')',',','!!!'')", "(a:!n,b:!t,c:!f)"};
+    for (int len = 0; len < 140; ++len) {
+      // runs of '!' and quotes straddling the 64-byte blocks
+      inputs.push_back("!(" + std::string(len, 'a') + ",'" + std::string(len % 7, ' ') + "!!!!!'" + std::string(len % 3 * 2, '!') +
+                       "(,)')");
+      inputs.push_back("(k" + std::string(len, 'x') + ":'" + std::string(len, '(') + "!'!'',z:!(" + std::string(len, '1') + "))");
+    }
+    bool ok = true;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      picorison::tape_document doc;
+      picorison::value v;
+      std::string err = doc.parse(inputs[i]), verr = picorison::parse(v, inputs[i]);
+      if (!err.empty() || !verr.empty() || doc.root().to_value() != v) {
+        printf("# tape mismatch: %s [%s] [%s]\n", inputs[i].c_str(), err.c_str(), verr.c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "tape and value parse agree");
+  }
+
+  {
+    const char *inputs[] = {"!",       "!Foa",  "(]",      "'abc\nd'", "!(1,!x)",   "(a:1",      "( 'a': !t )", "(123:456)",
+                            "!(1,2)x", "'abc",  "'a!x'",   "!(1 2)",   "(a:1,b)",   "!(1,2))",   "1e999",       "12abc",
+                            "!(1,'2)", "(a::1)", "!(1)!(", "a b",      "!(a,'b)", "((a:1))",   "!('a'b)"};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+      picorison::tape_document doc;
+      if (doc.parse(inputs[i]).empty()) {
+        printf("# tape accepted: %s\n", inputs[i]);
+        ok = false;
+      }
+    }
+    _ok(ok, "tape rejects invalid input");
+    picorison::tape_document doc;
+    is(doc.parse("(a:1,b:!x)"), std::string("syntax error at line 1 near: !x)"), "tape error message");
+  }
+
+  {
+    std::string rison = "!(";
+    for (int i = 0; i < 1000; ++i) {
+      rison += i != 0 ? "," : "";
+      rison += "(id:" + std::to_string(i) + ",name:'it!'s " + std::to_string(i) + "',tags:!(a,b,c))";
+    }
+    rison += ")";
+    picorison::tape_document doc;
+    _ok(doc.parse(rison).empty(), "tape large document no error");
+    _ok(doc.parse(rison).empty(), "tape large document reparse no error");
+    picorison::tape_element root = doc.root();
+    is(root.size(), size_t(1000), "tape large array size");
+    _ok(root.get(999).get("name").get<picorison::string_ref>() == "it's 999", "tape large document unescaped string");
+    picorison::value v;
+    picorison::parse(v, rison);
+    _ok(root.to_value() == v, "tape large document converts to the same value");
+  }
+
+  {
+    std::string s = "(query:(language:kuery,query:'a:(b)!'c!!'),filters:!((meta:(key:'x)',n:!(1,!(2,')'),3)),q:!n),"
+                    "(meta:(key:y))),skip:'(((',timeRange:(from:now-15m,to:now),dup:1,dup:2,e:!(),'k!'q':!t)";
+    picorison::lazy_value root(s);
+    _ok(root.is<picorison::object>(), "lazy root is object");
+    _ok(root["query"]["query"].get<std::string>() == "a:(b)'c!", "lazy nested string");
+    picorison::lazy_value meta = root["filters"][0]["meta"];
+    _ok(meta["key"].get<std::string>() == "x)", "lazy path through array");
+    _ok(meta["n"][1][1].get<std::string>() == ")", "lazy skips strings with parentheses");
+    _ok(meta["n"][2].get<double>() == 3, "lazy skips nested arrays");
+    is(root["filters"][1]["meta"]["key"].get<std::string>(), std::string("y"), "lazy second array item");
+    _ok(root["timeRange"]["to"].is<std::string>() && root["timeRange"]["to"].get<std::string>() == "now", "lazy id");
+    is(root["dup"].get<double>(), 1.0, "lazy returns the first of duplicated keys");
+    _ok(root["k'q"].is<bool>() && root["k'q"].get<bool>(), "lazy escaped key");
+    _ok(root["filters"][0]["q"].is<picorison::null>(), "lazy null");
+    _ok(root["missing"].is<picorison::null>() && !root.contains("missing"), "lazy missing key");
+    _ok(!root["filters"].contains(2) && root["filters"].contains(1), "lazy array bounds");
+    _ok(!root["e"].contains(0), "lazy empty array");
+    is(root["timeRange"].raw().str(), std::string("(from:now-15m,to:now)"), "lazy raw bytes");
+    picorison::value v;
+    picorison::parse(v, s);
+    _ok(root["filters"].to_value() == v.get("filters"), "lazy materializes a subtree");
+    _ok(root.to_value() == v, "lazy materializes the document");
+  }
+
+  {
+    std::string truncated_src = "(a:!(1,'x";
+    picorison::lazy_value truncated(truncated_src);
+    bool thrown = false;
+    try {
+      truncated["b"];
+    } catch (std::runtime_error &) {
+      thrown = true;
+    }
+    _ok(thrown, "lazy reports unterminated input");
+    std::string bad_src = "(a:1;b:2)";
+    picorison::lazy_value bad(bad_src);
+    thrown = false;
+    try {
+      bad["b"];
+    } catch (std::runtime_error &) {
+      thrown = true;
+    }
+    _ok(thrown, "lazy reports syntax errors on the navigated path");
+    std::string ctrl_src = "(a:'x\x01',b:1)";
+    picorison::lazy_value ctrl(ctrl_src);
+    thrown = false;
+    try {
+      ctrl["b"];
+    } catch (std::runtime_error &) {
+      thrown = true;
+    }
+    _ok(thrown, "lazy rejects strings with control characters");
+    std::string ctrl_end_src = "(a:'\x01";
+    picorison::lazy_value ctrl_end(ctrl_end_src);
+    thrown = false;
+    try {
+      ctrl_end["b"];
+    } catch (std::runtime_error &) {
+      thrown = true;
+    }
+    _ok(thrown, "lazy stops at the end of an unterminated string");
+  }
+
+  {
+    std::vector<std::string> values = {"abc", "-1.5e3", "!t", "!n", "''", "'a!'b!!c'", "()", "!()", "!(1,!(2,!(3)),(a:')'))",
+                                       "(a:'!'(',b:!('!!)',c))", "('((':'))')"};
+    for (int len = 0; len < 150; len += 7) {
+      std::string pad(len, 'p');
+      values.push_back("!(" + pad + ",'" + pad + "!'(!!',(" + pad + ":!(" + pad + ")),'" + std::string(len % 5, '!') +
+                       std::string(len % 5 % 2, '!') + "(')");
+      values.push_back("(" + pad + ":'" + std::string(len, ')') + "',z:!(!(!(" + pad + "))))");
+    }
+    bool ok = true;
+    for (size_t i = 0; i < values.size(); ++i) {
+      std::string s = values[i] + ",rest";
+      picorison::input<const char *> pin(s.data(), s.data() + s.size());
+      picorison::input<std::string::const_iterator> iin(s.begin(), s.end());
+      if (!picorison::skip(pin) || pin.cur() != s.data() + values[i].size() || !picorison::skip(iin) ||
+          iin.cur() != s.begin() + values[i].size()) {
+        printf("# skip mismatch: %s\n", values[i].c_str());
+        ok = false;
+      }
+      if (values[i].size() > 1) {
+        std::string truncated = values[i].substr(0, values[i].size() - 1);
+        picorison::input<const char *> tin(truncated.data(), truncated.data() + truncated.size());
+        picorison::input<std::string::const_iterator> gin(truncated.begin(), truncated.end());
+        bool scalar = values[i][0] != '\'' && values[i][0] != '(' && values[i][0] != '!';
+        if (!scalar && (picorison::skip(tin) || picorison::skip(gin))) {
+          printf("# skip accepted truncated: %s\n", truncated.c_str());
+          ok = false;
+        }
+      }
+    }
+    _ok(ok, "skip jumps over whole values");
+    std::vector<std::string> controls = {"'a\nb'", "(a:'x\n')", "!(1,\n2)", "'a!\n'", "!\n", "'a\x01',1",
+                                         "(a:!(" + std::string(100, 'x') + ",'\n'))", "!(" + std::string(70, 'x') + "\n)"};
+    for (size_t i = 0; i < controls.size(); ++i) {
+      const std::string &s = controls[i];
+      picorison::input<const char *> pin(s.data(), s.data() + s.size());
+      picorison::input<std::string::const_iterator> in(s.begin(), s.end());
+      if (picorison::skip(pin) || picorison::skip(in) || *in.cur() >= ' ' || in.line() != 1) {
+        printf("# skip accepted a control character: %s\n", s.c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "skip stops at control characters");
+    std::string closed = "!(a," + std::string(70, 'x') + ")\n";
+    picorison::input<const char *> cin(closed.data(), closed.data() + closed.size());
+    picorison::input<std::string::const_iterator> gin(closed.begin(), closed.end());
+    _ok(picorison::skip(cin) && *cin.cur() == '\n' && picorison::skip(gin) && *gin.cur() == '\n',
+        "skip accepts a value followed by a control character");
+  }
+
+  {
+    skip_context ctx;
+    std::string s = "(a:!((b:'x)'),!(1,2)),x:(y:!t),c:'it!'s')";
+    std::string err;
+    picorison::_parse(ctx, s.begin(), s.end(), &err);
+    _ok(err.empty(), "skip from a parse context no error");
+    _ok(ctx.x.get("y").get<bool>(), "skip from a parse context keeps the selected value");
+  }
+
+  {
+    std::vector<std::string> inputs = {"!n", "!t", "!f", "0", "-1.5e10", "abc", "", "''", "'a!!b!'c'", "()", "!()",
+                                       "(a:(b:!(1,2,(c:3))))", "(a:1,a:2)", "(:1)", "!(,)", "!('(',':',')',',','!!!'')",
+                                       "(a:!n,b:!t,c:!f,'d e':'')", "!(12345678901234567890,-0,0.5,1e-3)",
+                                       "(query:(language:kuery,query:'status:200 and host!'s'),filters:!())"};
+    bool ok = true;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      const std::string &s = inputs[i];
+      picorison::value expected;
+      picorison::parse(expected, s);
+      for (size_t split = 0; split <= s.size(); ++split) {
+        picorison::value v;
+        picorison::value_handler handler(&v);
+        picorison::basic_push_parser<picorison::value_handler> parser(handler);
+        parser.feed(s.data(), split);
+        parser.feed(s.data() + split, s.size() - split);
+        if (parser.finish() != parser.complete || v != expected) {
+          printf("# push mismatch: %s split at %zu [%s]\n", s.c_str(), split, parser.error().c_str());
+          ok = false;
+        }
+      }
+      picorison::value v;
+      picorison::value_handler handler(&v);
+      picorison::basic_push_parser<picorison::value_handler> parser(handler);
+      for (size_t j = 0; j < s.size(); ++j) {
+        parser.feed(&s[j], 1);
+      }
+      if (parser.finish() != parser.complete || v != expected) {
+        printf("# push mismatch: %s byte by byte [%s]\n", s.c_str(), parser.error().c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "push parser agrees with parse for any chunking");
+  }
+
+  {
+    const char *inputs[] = {"!",       "!Foa", "(]",     "'abc\nd'", "!(1,!x)", "(a:1",  "( 'a': !t )", "(123:456)", "!(1,2)x",
+                            "'abc",    "'a!x'", "!(1 2)", "(a:1,b)",  "!(1,2))", "12abc", "!(1,'2)",    "(a::1)",    "!(1)!(",
+                            "!(a,'b)", "((a:1))", "!('a'b)"};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+      picorison::value v;
+      picorison::value_handler handler(&v);
+      picorison::basic_push_parser<picorison::value_handler> parser(handler);
+      parser.feed(inputs[i], strlen(inputs[i]));
+      if (parser.finish() != parser.failed || parser.error().empty()) {
+        printf("# push accepted: %s\n", inputs[i]);
+        ok = false;
+      }
+    }
+    _ok(ok, "push parser rejects invalid input");
+  }
+
+  {
+    picorison::value v;
+    picorison::value_handler handler(&v);
+    picorison::basic_push_parser<picorison::value_handler> parser(handler);
+    is(parser.feed("(a:'x", 5), parser.need_more, "push parser needs more in a string");
+    is(parser.feed("y',b:12", 7), parser.need_more, "push parser needs more in a number");
+    is(parser.feed("3)", 2), parser.complete, "push parser completes at the closing parenthesis");
+    _ok(v.get("a").get<std::string>() == "xy" && v.get("b").get<double>() == 123, "push parser builds the value");
+    is(parser.feed(",", 1), parser.failed, "push parser rejects trailing input");
+    parser.reset();
+    is(parser.feed("(a:1,b:!x)", 10), parser.failed, "push parser fails");
+    is(parser.error(), std::string("syntax error at line 1 near: x)"), "push parser error message");
+    parser.reset();
+    handler.reset();
+    parser.feed("(a:1,", 5);
+    parser.feed("b:!x)", 5);
+    _ok(parser.error_info().offset == 8 && parser.error_info().column == 9, "push parser error offset counts earlier chunks");
+    parser.reset();
+    handler.reset();
+    parser.feed("(a:1", 4);
+    parser.finish();
+    _ok(parser.error_info().offset == 4 && parser.error_info().expected == "more input", "push parser error at the end of input");
+    parser.reset();
+    handler.reset();
+    parser.feed("1-", 2);
+    parser.feed("2", 1);
+    parser.finish();
+    is(parser.error_info().offset, size_t(0), "push parser error at a trailing number");
+    parser.reset();
+    handler.reset();
+    std::string ctrl = "(a:'xyz\x01')";
+    picorison::parse_error ctrl_err;
+    picorison::parse(v, ctrl.data(), ctrl.data() + ctrl.size(), ctrl_err);
+    parser.feed(ctrl.data(), 5);
+    parser.feed(ctrl.data() + 5, ctrl.size() - 5);
+    _ok(parser.error_info().offset == 7 && ctrl_err.offset == 7, "push parser error at a control character in a split string");
+    parser.reset();
+    handler.reset();
+    is(parser.feed("42", 2), parser.need_more, "push parser needs more after a top-level number");
+    is(parser.finish(), parser.complete, "push parser completes a top-level number on finish");
+    _ok(v.get<double>() == 42, "push parser reuse");
+  }
+
+  {
+    picorison::parse_limits limits;
+    limits.max_depth = 3;
+    picorison::value v;
+    _ok(picorison::parse(v, "!((a:!(1)))", limits).empty(), "limits allow depth 3");
+    is(picorison::parse(v, "!((a:!(!(1))))", limits), std::string("depth limit exceeded at line 1 near: !(1))))"),
+       "limits reject depth 4");
+    std::string deep;
+    for (int i = 0; i < 100000; ++i) {
+      deep += "!(";
+    }
+    _ok(picorison::parse(v, deep, limits).find("depth limit exceeded") == 0, "limits reject deeply nested input early");
+    _ok(picorison::parse(v, std::string(100000, '!') + "(", picorison::parse_limits()).find("syntax error") == 0,
+        "unlimited parse of garbage fails without recursion");
+  }
+
+  {
+    picorison::parse_limits limits;
+    limits.max_nodes = 4;
+    picorison::value v;
+    _ok(picorison::parse(v, "!(1,2,3)", limits).empty(), "limits allow 4 nodes");
+    is(picorison::parse(v, "(a:1,b:!(2,3))", limits), std::string("node limit exceeded at line 1 near: 3))"), "limits reject 5 nodes");
+  }
+
+  {
+    picorison::parse_limits limits;
+    limits.max_string_length = 3;
+    picorison::value v;
+    _ok(picorison::parse(v, "(abc:'d!'e',f:123)", limits).empty(), "limits allow short strings");
+    _ok(picorison::parse(v, "(abcd:1)", limits).find("string length limit exceeded") == 0, "limits reject long keys");
+    _ok(picorison::parse(v, "!('abcd')", limits).find("string length limit exceeded") == 0, "limits reject long strings");
+    _ok(picorison::parse(v, "!(1234)", limits).find("string length limit exceeded") == 0, "limits reject long numbers");
+  }
+
+  {
+    picorison::parse_limits limits;
+    limits.max_bytes = 8;
+    picorison::value v;
+    picorison::value_handler handler(&v);
+    picorison::basic_push_parser<picorison::value_handler> parser(handler, limits);
+    is(parser.feed("!(1,2", 5), parser.need_more, "limits count bytes across chunks");
+    is(parser.feed(",3,4)", 5), parser.failed, "limits reject too much input");
+    is(parser.error(), std::string("input size limit exceeded at line 1 near: 4)"), "limits report the first byte over");
+  }
+
+#ifdef PICORISON_USE_THREADS
+  {
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 10000; ++i) {
+      if (i % 97 == 0) {
+        inputs.push_back("(a:" + std::to_string(i) + ",b:!(x");
+      } else {
+        inputs.push_back("(a:" + std::to_string(i) + ",b:!(x," + std::string(i % 13, 'y') + "),c:'it!'s')");
+      }
+    }
+    std::vector<picorison::value> values;
+    std::vector<std::string> errs;
+    picorison::parse_batch(inputs.begin(), inputs.end(), values, errs, 4);
+    bool ok = values.size() == inputs.size() && errs.size() == inputs.size();
+    for (size_t i = 0; ok && i < inputs.size(); ++i) {
+      picorison::value v;
+      std::string err = picorison::parse(v, inputs[i]);
+      ok = values[i] == v && errs[i] == err;
+    }
+    _ok(ok, "parse_batch returns values and errors in input order");
+    std::vector<picorison::string_ref> refs(inputs.begin(), inputs.begin() + 10);
+    picorison::parse_batch(refs.begin(), refs.end(), values, errs);
+    _ok(values.size() == 10 && values[3].get("a").get<double>() == 3 && !errs[0].empty() && errs[1].empty(), "parse_batch with default threads");
+    picorison::parse_batch(refs.begin(), refs.begin(), values, errs);
+    _ok(values.empty() && errs.empty(), "parse_batch with no input");
+  }
+
+  {
+    std::string rison = "!(";
+    for (int i = 0; i < 2000; ++i) {
+      rison += i != 0 ? "," : "";
+      rison += "(id:" + std::to_string(i) + ",name:'it!'s ) " + std::to_string(i) + "',tags:!(a,!(b),(c:'(')))";
+    }
+    rison += ")";
+    picorison::value expected, v;
+    picorison::parse(expected, rison);
+    _ok(picorison::parse_array_parallel(v, rison.data(), rison.data() + rison.size(), 4).empty(), "parallel array no error");
+    _ok(v == expected, "parallel array matches serial parse");
+    std::vector<double> ids(2000, -1);
+    id_collector collector = {&ids};
+    std::string err = picorison::parse_array_parallel(rison.data(), rison.data() + 1000, collector, 2);
+    _ok(!err.empty(), "parallel array reports truncated input");
+    err = picorison::parse_array_parallel(rison.data(), rison.data() + rison.size(), collector, 4);
+    _ok(!err.empty() && ids[776] == 776 && ids[777] == 777, "parallel array callback can stop the parse");
+    const char *inputs[] = {"!()", "!(1)", "!(,)", "!(!(),())"};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+      picorison::parse(expected, inputs[i]);
+      ok = ok && picorison::parse_array_parallel(v, inputs[i], inputs[i] + strlen(inputs[i])).empty() && v == expected;
+    }
+    _ok(ok, "parallel array small inputs");
+    const char *bad[] = {"", "(a:1)", "!(1,2", "!(1,2)x", "!(1 2)", "!(1,!x)", "!((a:1)", "!('a)"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+      if (picorison::parse_array_parallel(v, bad[i], bad[i] + strlen(bad[i])).empty()) {
+        printf("# parallel array accepted: %s\n", bad[i]);
+        ok = false;
+      }
+    }
+    _ok(ok, "parallel array rejects invalid input");
+    is(picorison::parse_array_parallel(v, "!(1,(a:!x),3)", "!(1,(a:!x),3)" + 13), std::string("syntax error at line 1 near: ),3)"),
+       "parallel array error message");
+  }
+#endif
+
+  {
+    const char *encoded[] = {"(a:%27hello%20world%27,b:!(1,2))", "%28a%3A1%29", "'%E3%82%AF%E3%83%AA%E3%82%B9'", "(q:'a!'b')",
+                             "%21t", "'it%21%27s'"};
+    const char *decoded[] = {"(a:'hello world',b:!(1,2))", "(a:1)", "'\xe3\x82\xaf\xe3\x83\xaa\xe3\x82\xb9'", "(q:'a!'b')",
+                             "!t", "'it!'s'"};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(encoded) / sizeof(encoded[0]); ++i) {
+      picorison::value v1, v2;
+      std::string err1 = picorison::parse_url_encoded(v1, encoded[i]), err2 = picorison::parse(v2, decoded[i]);
+      if (err1.empty() != err2.empty() || v1 != v2) {
+        printf("# url encoded mismatch: %s [%s] [%s]\n", encoded[i], err1.c_str(), err2.c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "parse_url_encoded decodes as it parses");
+    picorison::value v;
+    _ok(picorison::parse_url_encoded(v, "'a+b'", true).empty() && v.get<std::string>() == "a b", "parse_url_encoded plus as space");
+    _ok(picorison::parse_url_encoded(v, "'a+b'").empty() && v.get<std::string>() == "a+b", "parse_url_encoded keeps plus");
+    is(picorison::parse_url_encoded(v, "(a:1,b:%21x%29)"), std::string("syntax error at line 1 near: %29)"),
+       "parse_url_encoded error quotes the encoded input");
+    is(picorison::parse_url_encoded(v, "'abc%ZZ'"), std::string("syntax error at line 1 near: %ZZ'"),
+       "parse_url_encoded rejects invalid escapes");
+    is(picorison::parse_url_encoded(v, "!(1)%29"), std::string("syntax error at line 1 near: %29"),
+       "parse_url_encoded rejects trailing input");
+    _ok(!picorison::parse_url_encoded(v, "%2").empty(), "parse_url_encoded rejects truncated escapes");
+  }
+
+  {
+    std::string query = "?_g=(time:(from:now-15m,to:now))&embed=true&_a=(query:(language:kuery,query:%27status%3A200+and+x%27))"
+                        "&_g=(ignored:!t)&_q=!(1,2)&flag";
+    picorison::string_ref names[] = {"_a", "_g", "_missing", "flag"};
+    picorison::value values[4];
+    std::string err;
+    is(picorison::parse_query(query, names, values, 4, &err), size_t(3), "parse_query finds the parameters");
+    _ok(err.empty(), "parse_query no error");
+    is(values[0].get("query").get("query").get<std::string>(), std::string("status:200 and x"), "parse_query decodes values");
+    is(values[1].get("time").get("from").get<std::string>(), std::string("now-15m"), "parse_query keeps the first occurrence");
+    _ok(values[2].is<picorison::null>(), "parse_query leaves missing parameters");
+    _ok(values[3].is<std::string>() && values[3].get<std::string>().empty(), "parse_query parameter without a value");
+    picorison::string_ref bad[] = {"_q", "_b"};
+    is(picorison::parse_query("_b=(a:%21x)&_q=!(1)", bad, values, 2, &err), size_t(2), "parse_query with an error");
+    is(err, std::string("_b: syntax error at line 1 near: )"), "parse_query reports the parameter");
+    _ok(values[0].get(0).get<double>() == 1, "parse_query continues after an error");
+    picorison::string_ref spaced[] = {"_g", "a b"};
+    is(picorison::parse_query("%5Fg=1&a+b=%21t&", spaced, values, 2), size_t(2), "parse_query decodes names");
+    _ok(values[0].get<double>() == 1 && values[1].get<bool>(), "parse_query values of encoded names");
+    std::vector<std::string> many_names;
+    std::string many_query;
+    for (int i = 0; i < 100; ++i) {
+      many_names.push_back("p" + std::to_string(i));
+      many_query += "&p" + std::to_string(99 - i) + "=" + std::to_string(99 - i);
+    }
+    std::vector<picorison::string_ref> many_refs(many_names.begin(), many_names.end());
+    std::vector<picorison::value> many_values(100);
+    is(picorison::parse_query(many_query, &many_refs[0], &many_values[0], 100), size_t(100), "parse_query with many names");
+    _ok(many_values[0].get<double>() == 0 && many_values[99].get<double>() == 99, "parse_query values of many names");
+  }
+
+  {
+    struct {
+      const char *input;
+      size_t offset;
+      const char *expected;
+    } cases[] = {{"(a:1,b:!x)", 8, "'n', 't', 'f' or '(' after '!'"},
+                 {"!(1,2", 5, "',' or ')'"},
+                 {"(a:1;b:2)", 4, "',' or ')'"},
+                 {"(a!b:1)", 2, "':'"},
+                 {"'ab!c'", 4, "an escape (!! or !')"},
+                 {"!(1,'ab", 7, "a closing quote"},
+                 {"!(1.2.3)", 7, "a number"}};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+      std::string s = cases[i].input;
+      std::string message;
+      picorison::value v;
+      picorison::parse(v, s.begin(), s.end(), &message);
+      picorison::parse_error e1, e2;
+      picorison::parse(v, s.data(), s.data() + s.size(), e1);
+      picorison::parse(v, s.begin(), s.end(), e2);
+      if (e1.offset != cases[i].offset || e1.expected != cases[i].expected || e1.line != 1 ||
+          e1.column != static_cast<int>(cases[i].offset) + 1 || e1.message != message || e2.offset != e1.offset ||
+          e2.expected != e1.expected || e2.column != e1.column || e2.message != e1.message) {
+        printf("# parse_error mismatch: %s: %zu %d:%d [%s] [%s], %zu %d:%d [%s] [%s]\n", s.c_str(), e1.offset, e1.line, e1.column,
+               e1.expected.c_str(), e1.message.c_str(), e2.offset, e2.line, e2.column, e2.expected.c_str(), e2.message.c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "parse_error reports the position and the expected token");
+    picorison::parse_error e;
+    picorison::value v;
+    std::string s = "!(1,\n2)";
+    picorison::parse(v, s.data(), s.data() + s.size(), e);
+    _ok(e.offset == 4 && e.line == 1 && e.column == 5 && e.expected == "a value", "parse_error at a newline");
+    s = "(a:1)";
+    picorison::parse(v, s.data(), s.data() + s.size(), e);
+    _ok(e.message.empty() && e.expected.empty() && e.offset == 0, "parse_error is cleared on success");
+  }
+
+  {
+    const char *inputs[] = {"!n", "!t", "!f", "0", "-1.5e10", "abc", "", "''", "'a!!b!'c'", "()", "!()", "(a:(b:!(1,2,(c:3))))",
+                            "(a:1,a:2)", "(:1)", "!(,)", "!('(',':',')',',','!!!'')", "(a:!n,b:!t,c:!f,'d e':'')",
+                            "!(12345678901234567890,-0,0.5,1e-3)", "!(1,2)rest", "!Foa", "(]", "!(1,!x)", "(a:1", "(a:1;b:2)",
+                            "'abc", "'a!x'", "(1:2)", "!(1.2.3)", "('a!'b':!(x,'y!!z'))"};
+    bool ok = true;
+    picorison::event_parser parser;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+      const char *s = inputs[i], *s_end = s + strlen(s);
+      picorison::value v1, v2;
+      std::string err1, err2;
+      picorison::value_handler handler(&v1);
+      const char *end1 = parser.parse(handler, s, s_end, &err1);
+      const char *end2 = picorison::parse(v2, s, s_end, &err2);
+      if (err1.empty() != err2.empty() || (err1.empty() && (end1 != end2 || v1 != v2))) {
+        printf("# event parser mismatch: %s [%s] [%s]\n", s, err1.c_str(), err2.c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "event_parser with value_handler agrees with parse");
+  }
+
+  {
+    picorison::event_parser parser;
+    event_counter counter;
+    std::string s = "(a:!(x,'y z','w!'v'),'k!!':(b:1))";
+    _ok(parser.parse(counter, s).empty(), "event_parser no error");
+    is(counter.values, size_t(7), "event_parser value events");
+    is(counter.keys, size_t(3), "event_parser key events");
+    _ok(counter.strings.size() == 6 && counter.strings[0] == s.data() + 1 && counter.strings[1] == s.data() + 5 &&
+            counter.strings[2] == s.data() + 8,
+        "event_parser passes unescaped strings and keys by reference");
+    _ok(!(s.data() <= counter.strings[3] && counter.strings[3] < s.data() + s.size()), "event_parser unescapes into scratch");
+    event_counter stopper;
+    is(parser.parse(stopper, "!(a,stop,b)"), std::string("syntax error at line 1 near: ,b)"), "event_parser handler can stop");
+    std::string deep;
+    for (int i = 0; i < 100000; ++i) {
+      deep += "!(";
+    }
+    deep += std::string(100000, ')');
+    event_counter counter2;
+    _ok(parser.parse(counter2, deep).empty() && counter2.max_depth == 100000, "event_parser does not recurse");
+  }
+
+  {
+    picorison::intern_table table;
+    picorison::string_ref a1 = table.intern(std::string("name")), a2 = table.intern(std::string("name"));
+    _ok(a1 == "name" && a1.data() == a2.data(), "intern returns the same atom");
+    _ok(table.intern(std::string("other")).data() != a1.data(), "intern distinct strings");
+    picorison::intern_table::stats st = table.get_stats();
+    _ok(st.hits == 1 && st.misses == 2 && st.size == 2, "intern stats");
+    table.clear();
+    is(table.get_stats().size, size_t(0), "intern clear");
+  }
+
+  {
+    picorison::intern_table table;
+    std::string s1 = "!((id:1,name:'a b',tag:x),(id:2,name:'c!'d',tag:x))", s2 = "(id:3,tag:x,long:yyyyyyyy)";
+    picorison::borrowed_document doc1, doc2;
+    doc1.set_intern_table(&table);
+    doc2.set_intern_table(&table, 4);
+    std::string err;
+    picorison::parse(doc1, s1.data(), s1.data() + s1.size(), &err);
+    _ok(err.empty(), "interned borrowed no error");
+    picorison::parse(doc2, s2.data(), s2.data() + s2.size(), &err);
+    _ok(err.empty(), "interned borrowed no error 2");
+    const picorison::borrowed_value::object &o1 = doc1.root().get(0).get<picorison::borrowed_value::object>();
+    const picorison::borrowed_value::object &o2 = doc1.root().get(1).get<picorison::borrowed_value::object>();
+    const picorison::borrowed_value::object &o3 = doc2.root().get<picorison::borrowed_value::object>();
+    _ok(o1[0].first.data() == o2[0].first.data() && o1[0].first.data() == o3[0].first.data(), "interned keys are shared");
+    _ok(o1[0].first.data() != s1.data() + 3, "interned keys do not refer to the input");
+    _ok(o1[2].second.get<picorison::string_ref>().data() == o3[1].second.get<picorison::string_ref>().data(),
+        "interned ids are shared");
+    _ok(o2[1].second.get<picorison::string_ref>() == "c'd", "interned unescaped string");
+    picorison::string_ref longid = o3[2].second.get<picorison::string_ref>();
+    _ok(longid == "yyyyyyyy" && longid.data() == s2.data() + 17, "long strings are not interned");
+    _ok(table.get_stats().hits > 0, "interned borrowed hits");
+    picorison::intern_table escaped_table;
+    std::string s3 = "('k!'q':'a!!b')";
+    picorison::borrowed_document doc3;
+    doc3.set_intern_table(&escaped_table);
+    picorison::parse(doc3, s3.data(), s3.data() + s3.size(), &err);
+    picorison::intern_table::stats escaped_st = escaped_table.get_stats();
+    _ok(err.empty() && escaped_st.hits == 0 && escaped_st.misses == 2, "escaped strings are interned once");
+  }
+
+#ifdef PICORISON_USE_THREADS
+  {
+    picorison::intern_table table(true);
+    const char *words[] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta"};
+    std::vector<std::vector<picorison::string_ref> > atoms(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < atoms.size(); ++t) {
+      threads.push_back(std::thread([&, t]() {
+        for (size_t i = 0; i < 1000; ++i) {
+          atoms[t].push_back(table.intern(std::string(words[(i + t) % 8])));
+        }
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+      threads[t].join();
+    }
+    bool ok = true;
+    for (size_t t = 0; t < atoms.size(); ++t) {
+      for (size_t i = 0; i < 1000; ++i) {
+        ok = ok && atoms[t][i] == words[(i + t) % 8] && atoms[t][i].data() == atoms[0][(i + t) % 8].data();
+      }
+    }
+    _ok(ok, "concurrent intern table returns the same atoms to all threads");
+    picorison::intern_table::stats st = table.get_stats();
+    _ok(st.size == 8 && st.misses == 8 && st.hits == 3992, "concurrent intern stats");
+  }
+#endif
+
+  {
+    bound_shape shape;
+    shape.weight = 0;
+    std::string err = picorison::parse_into(
+        shape, "(name:tri,closed:!t,skip:!((a:1)),pts:!((x:1,y:2.5,tags:!(a,'b c')),(y:-1,x:-3)),extra:(k:!n),weight:200,"
+        "flags:!(!t,!f,!t))");
+    _ok(err.empty(), "parse_into no error");
+    is(shape.name, std::string("tri"), "parse_into string");
+    _ok(shape.closed, "parse_into bool");
+    is(shape.pts.size(), size_t(2), "parse_into vector of structs");
+    _ok(shape.pts[0].x == 1 && shape.pts[0].y == 2.5 && shape.pts[1].x == -3 && shape.pts[1].y == -1, "parse_into numbers");
+    _ok(shape.pts[0].tags.size() == 2 && shape.pts[0].tags[1] == "b c" && shape.pts[1].tags.empty(), "parse_into vector of strings");
+    _ok(shape.extra.contains("k"), "parse_into value field");
+    is(int(shape.weight), 200, "parse_into unsigned char");
+    _ok(shape.flags.size() == 3 && shape.flags[0] && !shape.flags[1] && shape.flags[2], "parse_into vector of bools");
+  }
+
+  {
+    const char *cases[][2] = {
+        {"(name:a,closed:!f,pts:!((x:1.5,y:0)))", "type mismatch in pts[0].x (expected an integer) at line 1 near: 1.5,y:0)))"},
+        {"(name:a,closed:1,pts:!())", "type mismatch in closed (expected a boolean) at line 1 near: 1,pts:!())"},
+        {"(name:a,closed:!f,pts:!((x:1,y:'2')))", "type mismatch in pts[0].y (expected a number) at line 1 near: '2')))"},
+        {"(name:a,closed:!f,pts:!((x:1)))", "missing field y in pts[0] at line 1 near: ))"},
+        {"(name:a,pts:!())", "missing field closed at line 1 near: "},
+        {"(name:a,closed:!f,pts:!(),weight:256)", "value out of range in weight (expected an integer) at line 1 near: 256)"},
+        {"(name:a,closed:!f,pts:!(),flags:!(!t,0))", "type mismatch in flags[1] (expected a boolean) at line 1 near: 0))"},
+        {"(name:a,closed:!f,skip:(x:'y',z:!(1,'!')')),pts:!(),flags:!t)",
+         "type mismatch in flags (expected an array) at line 1 near: !t)"},
+        {"!(1)", "type mismatch (expected an object) at line 1 near: !(1)"},
+        {"(name:a,closed:!f,pts:!()", "syntax error at line 1 near: "},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+      bound_shape shape;
+      is(picorison::parse_into(shape, cases[i][0]), std::string(cases[i][1]), cases[i][0]);
+    }
+    bound_shape shape;
+    picorison::parse_error err;
+    std::string s = "(name:a,closed:!f,pts:!((x:1,y:!n)))";
+    picorison::parse_into(shape, s.data(), s.data() + s.size(), err);
+    _ok(err.expected == "a number" && err.offset == 31 && err.column == 32, "parse_into reports the expected type");
+    std::vector<int> ints;
+    _ok(picorison::parse_into(ints, "!(1,2,3)").empty() && ints.size() == 3 && ints[2] == 3, "parse_into vector root");
+    is(picorison::parse_into(ints, "!(1,x)"), std::string("type mismatch in [1] (expected an integer) at line 1 near: x)"),
+       "parse_into id is not an integer");
+    bool ok = true;
+    const char *junk[] = {"(x:1,junk:(a:b:c::,,),y:2)", "(x:1,junk:!(!q!z),y:2)", "(x:1,junk:1.2.3e,y:2)", "(x:1,junk:'a\x01',y:2)"};
+    for (size_t i = 0; i < sizeof(junk) / sizeof(junk[0]); ++i) {
+      bound_point pt;
+      std::string err = picorison::parse_into(pt, junk[i]);
+      if (err.compare(0, 12, "syntax error") != 0) {
+        printf("# parse_into accepted: %s [%s]\n", junk[i], err.c_str());
+        ok = false;
+      }
+    }
+    _ok(ok, "parse_into checks the values of unknown keys");
+    std::istringstream iss("(x:1,y:'2')");
+    bound_point pt;
+    std::string stream_err;
+    picorison::parse_into(pt, std::istreambuf_iterator<char>(iss), std::istreambuf_iterator<char>(), &stream_err);
+    is(stream_err, std::string("type mismatch in y (expected a number) at line 1 near: 2')"), "parse_into from a stream reports type errors");
+  }
+
+  {
+    is(picorison::value(std::string()).serialize(), std::string("''"), "empty string is quoted");
+    picorison::value o(picorison::object_type, false);
+    o.get<picorison::object>()[""] = picorison::value(std::string("a b"));
+    is(o.serialize(), std::string("('':'a b')"), "empty key is quoted");
+    std::string s = "\x01";
+    is(picorison::value(s).serialize(), std::string("''"), "control characters are dropped");
+    is(picorison::value(std::string("aクリス")).serialize(), std::string("aクリス"), "non-ASCII needs no quotes");
+    // compare against a character-by-character serializer for strings around the SIMD block size
+    const char alphabet[] = "ab-9 !'~(\x01\xe3_";
+    bool ok = true;
+    for (size_t len = 0; len < 40 && ok; ++len) {
+      for (size_t pos = 0; pos < len || pos == 0; ++pos) {
+        for (size_t k = 0; k + 1 < sizeof(alphabet) && ok; ++k) {
+          std::string str(len, 'x');
+          if (len != 0) {
+            str[pos] = alphabet[k];
+            str[len - 1 - pos / 2] = alphabet[(k + 3) % (sizeof(alphabet) - 1)];
+          }
+          bool quote = str.empty() || (picorison::char_class(str[0]) & picorison::id_start_reject_class);
+          std::string body;
+          for (size_t i = 0; i < str.size(); ++i) {
+            int cls = picorison::char_class(str[i]);
+            quote = quote || (cls & picorison::quote_char_class) || (cls & picorison::control_char_class);
+            if (cls & picorison::escape_char_class) {
+              body += '!';
+            }
+            if (!(cls & picorison::control_char_class)) {
+              body += str[i];
+            }
+          }
+          std::string expected = quote ? "'" + body + "'" : body;
+          if (picorison::value(str).serialize() != expected) {
+            printf("# serialize mismatch: %s\n", expected.c_str());
+            ok = false;
+          }
+        }
+      }
+    }
+    _ok(ok, "serialize_str agrees with a character-by-character serializer");
+    std::ostringstream os;
+    os << picorison::value(std::string("it's a long string with spaces"));
+    is(os.str(), std::string("'it!'s a long string with spaces'"), "serialize to a stream");
+  }
+
+  {
+    const struct {
+      double v;
+      const char *s;
+    } cases[] = {{0.0, "0"},           {-0.0, "-0"},        {1.0, "1"},         {-42.0, "-42"},     {0.1, "0.1"},
+                 {1.5, "1.5"},         {-2.5e-3, "-0.0025"}, {1e-6, "0.000001"}, {1e-7, "1e-7"},     {123e-20, "1.23e-18"},
+                 {1e20, "100000000000000000000"},           {1e21, "1e21"},     {1.5e300, "1.5e300"},
+                 {9007199254740993.0, "9007199254740992"}, {5e-324, "5e-324"}, {1.7976931348623157e308, "1.7976931348623157e308"},
+                 {0.30000000000000004, "0.30000000000000004"}};
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+      is(picorison::value(cases[i].v).serialize(), std::string(cases[i].s), cases[i].s);
+    }
+#ifdef PICORISON_USE_INT64
+    is(picorison::value(std::numeric_limits<int64_t>::min()).serialize(), std::string("-9223372036854775808"), "format int64 min");
+    is(picorison::value(int64_t(0)).serialize(), std::string("0"), "format int64 zero");
+#endif
+    // every double reads back as itself, in at most 17 digits
+    uint64_t state = 88172645463325252ull;
+    size_t mismatches = 0, longer = 0;
+    for (int i = 0; i < 200000; ++i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      double d;
+      uint64_t bits = i % 2 ? state : state >> (state & 63);
+      memcpy(&d, &bits, sizeof(d));
+      if (std::isnan(d) || std::isinf(d)) {
+        continue;
+      }
+      std::string s = picorison::value(d).serialize();
+      picorison::value v;
+      std::string err = picorison::parse(v, s);
+      if (!err.empty() || !v.is<double>() || memcmp(&v.get<double>(), &d, sizeof(d)) != 0) {
+        if (mismatches++ < 5) {
+          printf("# format mismatch: %.17g %s\n", d, s.c_str());
+        }
+      }
+      char buf[32];
+      for (int prec = 1; prec <= 17; ++prec) {
+        snprintf(buf, sizeof(buf), "%.*e", prec - 1, d);
+        if (strtod(buf, NULL) == d) {
+          std::string digits;
+          for (size_t j = 0; j < s.size() && s[j] != 'e'; ++j) {
+            if (('1' <= s[j] && s[j] <= '9') || (s[j] == '0' && !digits.empty())) {
+              digits += s[j];
+            }
+          }
+          digits.erase(digits.find_last_not_of('0') + 1);
+          longer += digits.size() > static_cast<size_t>(prec);
+          break;
+        }
+      }
+    }
+    is(mismatches, size_t(0), "formatted doubles round-trip");
+    _ok(longer < 200, "formatted doubles are almost always shortest");
+  }
+
+  {
+    const char *inputs[] = {"!n", "!t", "!f", "0", "-1.5e10", "abc", "''", "'a!!b!'c'", "()", "!()", "(a:(b:!(1,2,(c:3))))",
+                            "!('(',':',')',',','!!!'')", "(a:!n,b:!t,c:!f,'d e':'',zz:!(!(),()))", "!(12345678901234567890,-0,0.5,1e-3)"};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+      picorison::value v;
+      picorison::parse(v, inputs[i]);
+      ok = ok && v.serialized_size() == v.serialize().size();
+    }
+    picorison::value ctrl(std::string("a\x01!b"));
+    ok = ok && ctrl.serialized_size() == ctrl.serialize().size();
+    _ok(ok, "serialized_size matches serialize");
+
+    picorison::value v;
+    picorison::parse(v, "(a:!(1,'x y'),b:(c:!t))");
+    const std::string expected = v.serialize();
+    char buf[64];
+    memset(buf, '#', sizeof(buf));
+    is(v.serialize_to(buf, sizeof(buf)), expected.size(), "serialize_to returns the length");
+    _ok(std::string(buf, expected.size()) == expected && buf[expected.size()] == '#', "serialize_to writes exactly the output");
+    memset(buf, '#', sizeof(buf));
+    is(v.serialize_to(buf, expected.size() - 1), expected.size(), "serialize_to returns the length needed");
+    is(buf[0], '#', "serialize_to writes nothing if the output does not fit");
+    char buf2[64] = {0};
+    v.serialize(buf2);
+    is(std::string(buf2), expected, "serialize to a pointer");
+  }
+
+  {
+    picorison::value v;
+    std::string rison = "!(";
+    for (int i = 0; i < 3000; ++i) {
+      rison += "(id:" + std::to_string(i) + ",name:'it!'s " + std::string(i % 50, 'x') + "',tags:!(a,b))" + (i != 2999 ? "," : "");
+    }
+    rison += ")";
+    picorison::parse(v, rison);
+    const std::string expected = v.serialize();
+
+    std::string s;
+    picorison::string_sink ss(&s);
+    picorison::serialize(v, ss);
+    is(s, expected, "serialize to string_sink");
+
+    std::vector<size_t> chunks;
+    std::string collected;
+    {
+      auto f = [&](const char *p, size_t n) {
+        chunks.push_back(n);
+        collected.append(p, n);
+      };
+      picorison::callback_sink<decltype(f)> cs(f);
+      picorison::serialize(v, cs);
+    }
+    is(collected, expected, "serialize to callback_sink");
+    _ok(chunks.size() <= expected.size() / 4096 + 1, "callback_sink passes the output in chunks");
+
+    std::stringbuf sb;
+    picorison::streambuf_sink bs(&sb);
+    picorison::serialize(v, bs);
+    _ok(bs.good() && sb.str() == expected, "serialize to streambuf_sink");
+
+#ifdef PICORISON_USE_POSIX
+    FILE *fp = tmpfile();
+    {
+      picorison::basic_fd_sink<64> fs(fileno(fp));
+      picorison::serialize(v, fs);
+      fs.flush();
+      _ok(fs.good(), "fd_sink no error");
+    }
+    std::string read_back(expected.size() + 1, '\0');
+    rewind(fp);
+    read_back.resize(fread(&read_back[0], 1, read_back.size(), fp));
+    fclose(fp);
+    is(read_back, expected, "serialize to fd_sink");
+#endif
+  }
+
+  {
+    std::string out;
+    picorison::string_sink sink(&out);
+    picorison::writer w(&sink, true);
+    w.begin_object().key("q").string("it's").key("ids").begin_array().integer(1).integer(-2).number(0.5).end();
+    w.key("empty").string("").key("a b").begin_object().end().key("flags").begin_array().boolean(true).null().end();
+    picorison::value nested;
+    picorison::parse(nested, "(y:!(1,'x y'))");
+    w.key("v").write(nested).end();
+    _ok(w.complete(), "writer complete");
+    is(out, std::string("(q:'it!'s',ids:!(1,-2,0.5),empty:'','a b':(),flags:!(!t,!n),v:(y:!(1,'x y')))"), "writer output");
+    picorison::value v;
+    _ok(picorison::parse(v, out).empty() && v.get("ids").get(1).get<double>() == -2, "writer output parses");
+
+    out.clear();
+    w.reset();
+    w.begin_array().begin_array().end().string("x").end();
+    is(out, std::string("!(!(),x)"), "writer reuse");
+
+    const char *misuse[] = {"key outside an object", "value without a key", "key without a value", "end without an open container",
+                            "more than one value"};
+    for (int i = 0; i < 5; ++i) {
+      out.clear();
+      w.reset();
+      std::string what;
+      try {
+        switch (i) {
+        case 0:
+          w.begin_array().key("k");
+          break;
+        case 1:
+          w.begin_object().integer(1);
+          break;
+        case 2:
+          w.begin_object().key("k").end();
+          break;
+        case 3:
+          w.null().end();
+          break;
+        default:
+          w.null().null();
+          break;
+        }
+      } catch (const std::runtime_error &e) {
+        what = e.what();
+      }
+      _ok(what.find(misuse[i]) != std::string::npos, misuse[i]);
+    }
+    out.clear();
+    picorison::writer unchecked(&sink);
+    unchecked.begin_array().integer(1).end().end();
+    is(out, std::string("!(1))"), "unchecked writer does not check");
+  }
+
   return done_testing();
 }